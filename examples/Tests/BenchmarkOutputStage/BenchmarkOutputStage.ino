@@ -0,0 +1,82 @@
+/**
+ * Measures the frames per second of the volume control and resampling for
+ * interleaved 16 bit stereo audio: compare the VolumeStream -> ResampleStream
+ * chain with the fused SnapVolumeResampleStream. The step size 1.0001
+ * corresponds to a drift correction of 100 ppm.
+ */
+#include "AudioTools.h"
+#include "SnapClient.h"
+
+const int channels = 2;
+const int frames = 512;
+const int count = 2000;
+int16_t pcm[frames * channels];
+AudioInfo info(48000, channels, 16);
+NullStream null_out;
+
+void setupAudio() {
+  for (int j = 0; j < frames; j++) {
+    int16_t sample = 10000.0 * sin(2.0 * PI * 440.0 * j / info.sample_rate);
+    pcm[j * channels] = sample;
+    pcm[j * channels + 1] = sample;
+  }
+}
+
+void report(const char *name, float step, uint32_t start_us) {
+  uint32_t time_us = micros() - start_us;
+  char msg[120];
+  snprintf(msg, sizeof(msg), "%s (step %.4f): %u us -> %f frames/sec", name,
+           step, (unsigned)time_us, 1000000.0 * frames * count / time_us);
+  Serial.println(msg);
+}
+
+void benchmarkChain(float step) {
+  ResampleStream resample;
+  VolumeStream vol_stream;
+  resample.setOutput(null_out);
+  vol_stream.setStream(resample);
+  auto res_cfg = resample.defaultConfig();
+  res_cfg.copyFrom(info);
+  res_cfg.step_size = step;
+  resample.begin(res_cfg);
+  auto vol_cfg = vol_stream.defaultConfig();
+  vol_cfg.copyFrom(info);
+  vol_cfg.allow_boost = true;
+  vol_stream.begin(vol_cfg);
+  vol_stream.setVolume(0.8);
+
+  uint32_t start = micros();
+  for (int j = 0; j < count; j++) {
+    vol_stream.write((const uint8_t *)pcm, sizeof(pcm));
+  }
+  report("VolumeStream + ResampleStream", step, start);
+}
+
+void benchmarkFused(float step) {
+  SnapVolumeResampleStream fused;
+  fused.setOutput(null_out);
+  fused.setAudioInfo(info);
+  fused.begin();
+  fused.setVolume(0.8);
+  fused.setStepSize(step);
+
+  uint32_t start = micros();
+  for (int j = 0; j < count; j++) {
+    fused.write((const uint8_t *)pcm, sizeof(pcm));
+  }
+  report("SnapVolumeResampleStream", step, start);
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupAudio();
+  null_out.setAudioInfo(info);
+
+  float steps[] = {1.0, 1.0001, 0.9999};
+  for (float step : steps) {
+    benchmarkChain(step);
+    benchmarkFused(step);
+  }
+}
+
+void loop() {}
@@ -0,0 +1,95 @@
+/**
+ * Measures the time needed to decode the codec header and wire chunk messages.
+ * The copying decoder reproduces the former implementation which copied the
+ * codec name and payload into std::vectors: compare it with the view based
+ * decoding that is used by the SnapProcessor. The decoded values are written
+ * to a volatile sink, so that the compiler can not remove the decoding.
+ */
+#include "AudioTools.h"
+#include "SnapClient.h"
+
+const int count = 100000;
+char codec_header[4 + 4 + 4 + 19];
+char wire_chunk[12 + 1024];
+volatile uint32_t sink = 0;
+
+/// Codec header decoding as it was done before the introduction of SnapView
+struct CopyingCodecHeader {
+  std::vector<char> v_codec;
+  uint32_t size;
+  std::vector<char> v_payload;
+
+  int deserialize(const char *data, uint32_t reqSize) {
+    SnapReadBuffer buffer;
+    uint32_t string_size;
+    int result = 0;
+    buffer.begin(data, reqSize);
+    result |= buffer.read_uint32(&string_size);
+    if (result) return 1;
+    if (v_codec.size() < string_size + 1) v_codec.resize(string_size + 1);
+    result |= buffer.read(&v_codec[0], string_size);
+    v_codec[string_size] = '\0';
+    result |= buffer.read_uint32(&size);
+    if (result) return 1;
+    if (v_payload.size() < reqSize) v_payload.resize(reqSize);
+    result |= buffer.read(&v_payload[0], size);
+    return result;
+  }
+};
+
+void setupMessages() {
+  SnapWriteBuffer buffer;
+  buffer.begin(codec_header, sizeof(codec_header));
+  buffer.write_uint32(4);
+  buffer.write("opus", 4);
+  buffer.write_uint32(19);
+  char opus_header[19] = {0};
+  buffer.write(opus_header, sizeof(opus_header));
+
+  buffer.begin(wire_chunk, sizeof(wire_chunk));
+  buffer.write_int32(1700000000);
+  buffer.write_int32(500000);
+  buffer.write_uint32(1024);
+}
+
+void report(const char *name, uint32_t start_us) {
+  uint32_t time_us = micros() - start_us;
+  char msg[120];
+  snprintf(msg, sizeof(msg), "%s: %d messages in %u us -> %f us/message", name,
+           count, (unsigned)time_us, (float)time_us / count);
+  Serial.println(msg);
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupMessages();
+  int errors = 0;
+
+  uint32_t start = micros();
+  for (int j = 0; j < count; j++) {
+    CopyingCodecHeader header;
+    errors += header.deserialize(codec_header, sizeof(codec_header));
+    sink = sink + header.v_codec[0] + header.size + header.v_payload[0];
+  }
+  report("codec header (copy)", start);
+
+  start = micros();
+  for (int j = 0; j < count; j++) {
+    SnapMessageCodecHeader header;
+    errors += header.deserialize(codec_header, sizeof(codec_header));
+    sink = sink + header.codec.data[0] + header.size + header.payload[0];
+  }
+  report("codec header (view)", start);
+
+  start = micros();
+  for (int j = 0; j < count; j++) {
+    SnapMessageWireChunk chunk;
+    errors += chunk.deserialize(wire_chunk, sizeof(wire_chunk));
+    sink = sink + chunk.timestamp.usec + chunk.size + chunk.payload[0];
+  }
+  report("wire chunk (view)", start);
+
+  if (errors) Serial.println("deserialization errors");
+}
+
+void loop() {}
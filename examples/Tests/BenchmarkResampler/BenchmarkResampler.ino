@@ -0,0 +1,81 @@
+/**
+ * Measures the CPU time which is needed by the polyphase resampler per second
+ * of 16 bit stereo audio for each quality preset: for the drift correction
+ * (48000 at 100 ppm) and for the rate conversions 44100 <-> 48000. The
+ * linear interpolating ResampleStream is measured as reference.
+ */
+#include "AudioTools.h"
+#include "SnapClient.h"
+
+const int channels = 2;
+const int frames = 480;
+const int seconds = 10;
+int16_t pcm[frames * channels];
+NullStream null_out;
+
+void setupAudio(int rate) {
+  for (int j = 0; j < frames; j++) {
+    int16_t sample = 10000.0 * sin(2.0 * PI * 440.0 * j / rate);
+    pcm[j * channels] = sample;
+    pcm[j * channels + 1] = sample;
+  }
+}
+
+/// writes the indicated number of seconds of audio: returns the time in us
+uint32_t writeAudio(Print &out, int rate) {
+  setupAudio(rate);
+  int count = seconds * rate / frames;
+  uint32_t start = micros();
+  for (int j = 0; j < count; j++) {
+    out.write((const uint8_t *)pcm, sizeof(pcm));
+  }
+  return micros() - start;
+}
+
+void report(const char *name, int from, int to, uint32_t time_us) {
+  char msg[120];
+  snprintf(msg, sizeof(msg), "%s %d -> %d: %f us per second of audio (%f%%)",
+           name, from, to, (float)time_us / seconds,
+           100.0 * time_us / seconds / 1000000.0);
+  Serial.println(msg);
+}
+
+void benchmarkPolyphase(SnapResampleQuality quality, int from, int to) {
+  const char *names[] = {"polyphase low", "polyphase medium",
+                         "polyphase high"};
+  SnapPolyphaseResampleStream resampler;
+  resampler.setOutput(null_out);
+  resampler.setQuality(quality);
+  resampler.setAudioInfo(AudioInfo(from, channels, 16));
+  resampler.setOutputRate(to);
+  resampler.begin();
+  if (from == to) resampler.setStepSize(1.0001);
+  report(names[quality], from, to, writeAudio(resampler, from));
+}
+
+void benchmarkLinear(int from) {
+  ResampleStream resample;
+  resample.setOutput(null_out);
+  auto cfg = resample.defaultConfig();
+  cfg.copyFrom(AudioInfo(from, channels, 16));
+  cfg.step_size = 1.0001;
+  resample.begin(cfg);
+  report("ResampleStream", from, from, writeAudio(resample, from));
+}
+
+void setup() {
+  Serial.begin(115200);
+  null_out.setAudioInfo(AudioInfo(48000, channels, 16));
+
+  SnapResampleQuality presets[] = {SnapResampleLow, SnapResampleMedium,
+                                   SnapResampleHigh};
+  int rates[][2] = {{48000, 48000}, {44100, 48000}, {48000, 44100}};
+  benchmarkLinear(48000);
+  for (auto quality : presets) {
+    for (auto &rate : rates) {
+      benchmarkPolyphase(quality, rate[0], rate[1]);
+    }
+  }
+}
+
+void loop() {}
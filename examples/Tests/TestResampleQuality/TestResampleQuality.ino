@@ -0,0 +1,81 @@
+/**
+ * Changes the quality preset of the polyphase resampler while a sine is
+ * converted from 44100 to 48000: the output must stay a continuous sine
+ * without clicks, so the difference between two samples must stay below the
+ * max slope of the sine.
+ */
+#include "AudioTools.h"
+#include "SnapClient.h"
+
+const int channels = 2;
+const int from_rate = 44100;
+const int to_rate = 48000;
+const float amplitude = 10000.0;
+const float freq = 440.0;
+const int frames = 441;
+
+/// checks the slope of the resampled sine
+class SlopeCheck : public Print {
+ public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *data, size_t len) override {
+    const int16_t *samples = (const int16_t *)data;
+    for (size_t j = 0; j < len / sizeof(int16_t); j += channels) {
+      int step = abs(samples[j] - last);
+      if (count++ > 0 && step > max_step) max_step = step;
+      last = samples[j];
+    }
+    return len;
+  }
+  int maxStep() { return max_step; }
+  void reset() { max_step = 0; }
+
+ protected:
+  int16_t last = 0;
+  int max_step = 0;
+  uint32_t count = 0;
+};
+
+SlopeCheck check;
+SnapPolyphaseResampleStream resampler;
+int16_t pcm[frames * channels];
+uint32_t frame_pos = 0;
+
+void writeSine(int count) {
+  for (int c = 0; c < count; c++) {
+    for (int j = 0; j < frames; j++) {
+      int16_t sample = amplitude * sin(2.0 * PI * freq * frame_pos++ / from_rate);
+      pcm[j * channels] = sample;
+      pcm[j * channels + 1] = sample;
+    }
+    resampler.write((const uint8_t *)pcm, sizeof(pcm));
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  resampler.setOutput(check);
+  resampler.setQuality(SnapResampleLow);
+  resampler.setAudioInfo(AudioInfo(from_rate, channels, 16));
+  resampler.setOutputRate(to_rate);
+  resampler.begin();
+
+  // ignore the start from the initial silence
+  writeSine(10);
+  check.reset();
+  SnapResampleQuality presets[] = {SnapResampleHigh, SnapResampleLow,
+                                   SnapResampleMedium, SnapResampleHigh};
+  for (auto quality : presets) {
+    resampler.setQuality(quality);
+    writeSine(10);
+  }
+
+  // max difference of two samples of the sine at the output rate (+10%)
+  int limit = 1.1 * amplitude * 2.0 * PI * freq / to_rate + 1;
+  char msg[80];
+  snprintf(msg, sizeof(msg), "max step: %d (limit %d) -> %s", check.maxStep(),
+           limit, check.maxStep() <= limit ? "OK" : "FAILED");
+  Serial.println(msg);
+}
+
+void loop() {}
@@ -159,6 +159,16 @@ class SnapClient {
   /// Defines the Snap output implementation to be used
   void setSnapOutput(SnapOutput &out) { p_snapprocessor->setSnapOutput(out); }
 
+  /// Defines the callback which is called for the stream tags (metadata)
+  void setStreamTagsCallback(void (*callback)(SnapMessageStreamTags &tags)) {
+    p_snapprocessor->setStreamTagsCallback(callback);
+  }
+
+  /// Defines the storage for the clock model (e.g. SnapClockStoreNVS)
+  void setClockStore(SnapClockStore &store) {
+    p_snapprocessor->setClockStore(store);
+  }
+
   /// Call from Arduino Loop - to receive and process the audio data
   bool doLoop() { return p_snapprocessor->doLoop(); }
 
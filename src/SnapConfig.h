@@ -22,9 +22,52 @@
 #ifndef CONFIG_SNAPCAST_SERVER_PORT 
 #  define CONFIG_SNAPCAST_SERVER_PORT 1704
 #endif
+// parse buffer with a fixed size: all messages except the audio chunks need
+// to fit into it. Bigger audio chunks are passed on in parts of this size, but
+// opus chunks can not be split.
 #ifndef CONFIG_SNAPCAST_BUFF_LEN 
 #  define CONFIG_SNAPCAST_BUFF_LEN 1024
 #endif
+// max size per message type: bigger messages are discarded
+#ifndef CONFIG_SNAPCAST_MAX_CODEC_HEADER_SIZE 
+#  define CONFIG_SNAPCAST_MAX_CODEC_HEADER_SIZE CONFIG_SNAPCAST_BUFF_LEN
+#endif
+// covers e.g. 170 ms of 16 bit stereo PCM at 48000 or 40 ms of 32 bit 4
+// channel PCM at 48000: this does not need any additional memory
+#ifndef CONFIG_SNAPCAST_MAX_WIRE_CHUNK_SIZE 
+#  define CONFIG_SNAPCAST_MAX_WIRE_CHUNK_SIZE (32 * 1024)
+#endif
+#ifndef CONFIG_SNAPCAST_MAX_SERVER_SETTINGS_SIZE 
+#  define CONFIG_SNAPCAST_MAX_SERVER_SETTINGS_SIZE 512
+#endif
+#ifndef CONFIG_SNAPCAST_MAX_TIME_SIZE 
+#  define CONFIG_SNAPCAST_MAX_TIME_SIZE 64
+#endif
+#ifndef CONFIG_SNAPCAST_MAX_STREAM_TAGS_SIZE 
+#  define CONFIG_SNAPCAST_MAX_STREAM_TAGS_SIZE 1024
+#endif
+// size of the buffer which receives all available data with one read: 0 reads
+// each header and payload directly from the client
+#ifndef CONFIG_SNAPCAST_RECEIVE_BUFFER_SIZE 
+#  define CONFIG_SNAPCAST_RECEIVE_BUFFER_SIZE 1024
+#endif
+// messages bigger then this are considered to be corrupted
+#ifndef CONFIG_SNAPCAST_MAX_VALID_MESSAGE_SIZE 
+#  define CONFIG_SNAPCAST_MAX_VALID_MESSAGE_SIZE 100000
+#endif
+// max time difference in sec between the sent time of consecutive messages
+// when we search for the next valid message
+#ifndef CONFIG_SNAPCAST_RESYNC_MAX_TIME_JUMP_SEC 
+#  define CONFIG_SNAPCAST_RESYNC_MAX_TIME_JUMP_SEC 10
+#endif
+// we reconnect if we can not find a valid message within this number of bytes
+#ifndef CONFIG_SNAPCAST_RESYNC_MAX_BYTES 
+#  define CONFIG_SNAPCAST_RESYNC_MAX_BYTES (64 * 1024)
+#endif
+// size of the stack buffer used to discard messages
+#ifndef CONFIG_SNAPCAST_DISCARD_SLICE 
+#  define CONFIG_SNAPCAST_DISCARD_SLICE 128
+#endif
 #ifndef CONFIG_SNAPCAST_CLIENT_NAME 
 #  define CONFIG_SNAPCAST_CLIENT_NAME "arduino-snapclient"
 #endif
@@ -34,6 +77,71 @@
 #ifndef CONFIG_CLIENT_TIMEOUT_SEC 
 #  define CONFIG_CLIENT_TIMEOUT_SEC 5
 #endif
+// reconnect: exponential backoff between the min and max delay
+#ifndef CONFIG_SNAPCAST_RECONNECT_MIN_MS 
+#  define CONFIG_SNAPCAST_RECONNECT_MIN_MS 100
+#endif
+#ifndef CONFIG_SNAPCAST_RECONNECT_MAX_MS 
+#  define CONFIG_SNAPCAST_RECONNECT_MAX_MS 8000
+#endif
+// number of time messages used to filter the client/server time difference
+#ifndef CONFIG_SNAPCAST_TIME_FILTER_SIZE 
+#  define CONFIG_SNAPCAST_TIME_FILTER_SIZE 50
+#endif
+// time messages: fast burst after the hello, then back off to the interval
+#ifndef CONFIG_SNAPCAST_TIME_INTERVAL_MS 
+#  define CONFIG_SNAPCAST_TIME_INTERVAL_MS 1000
+#endif
+#ifndef CONFIG_SNAPCAST_TIME_BURST_INTERVAL_MS 
+#  define CONFIG_SNAPCAST_TIME_BURST_INTERVAL_MS 100
+#endif
+#ifndef CONFIG_SNAPCAST_TIME_BURST_COUNT 
+#  define CONFIG_SNAPCAST_TIME_BURST_COUNT 10
+#endif
+// the burst ends when the error of the time difference is below this value
+#ifndef CONFIG_SNAPCAST_TIME_STABLE_ERROR_US 
+#  define CONFIG_SNAPCAST_TIME_STABLE_ERROR_US 1000
+#endif
+// interval in which the clock model is persisted (if a store is defined)
+#ifndef CONFIG_SNAPCAST_CLOCK_SAVE_SEC 
+#  define CONFIG_SNAPCAST_CLOCK_SAVE_SEC 300
+#endif
+// buffered chunks which are due later than this are kept back at playout
+#ifndef CONFIG_SNAPCAST_PLAYOUT_EARLY_MS 
+#  define CONFIG_SNAPCAST_PLAYOUT_EARLY_MS 100
+#endif
+// buffered chunks which are later than this are shortened at playout
+#ifndef CONFIG_SNAPCAST_PLAYOUT_LATE_MS 
+#  define CONFIG_SNAPCAST_PLAYOUT_LATE_MS 20
+#endif
+// differences of the chunk timestamps to the decoded audio which are
+// considered as gap: must be bigger then the latency of the decoder
+#ifndef CONFIG_SNAPCAST_GAP_MIN_MS 
+#  define CONFIG_SNAPCAST_GAP_MIN_MS 50
+#endif
+// length of the silence which is written per step on a buffer underrun
+#ifndef CONFIG_SNAPCAST_CONCEAL_MS 
+#  define CONFIG_SNAPCAST_CONCEAL_MS 10
+#endif
+// max length of the pending silence (e.g. for the start alignment) which is
+// written per step, so that the silence is written at the pace of the output
+#ifndef CONFIG_SNAPCAST_SILENCE_SLICE_MS 
+#  define CONFIG_SNAPCAST_SILENCE_SLICE_MS 20
+#endif
+// number of frames to fade out before and to fade in after inserted silence
+#ifndef CONFIG_SNAPCAST_FADE_FRAMES 
+#  define CONFIG_SNAPCAST_FADE_FRAMES 256
+#endif
+// preset of the polyphase resampler: 0 = low, 1 = medium, 2 = high quality
+#ifndef CONFIG_SNAPCAST_RESAMPLE_QUALITY 
+#  if defined(ESP32)
+#    define CONFIG_SNAPCAST_RESAMPLE_QUALITY 1
+#  elif defined(__linux__) || defined(IS_DESKTOP)
+#    define CONFIG_SNAPCAST_RESAMPLE_QUALITY 2
+#  else
+#    define CONFIG_SNAPCAST_RESAMPLE_QUALITY 0
+#  endif
+#endif
 #ifndef CONFIG_PROCESSING_TIME_MS 
 #  define CONFIG_PROCESSING_TIME_MS -172
 #endif
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "SnapLogger.h"
+
+#if defined(ESP32)
+#  include "nvs.h"
+#endif
+
+namespace snap_arduino {
+
+/**
+ * @brief The clock model which is persisted: the offset to the server is not
+ * stored because the monotonic clock restarts with each boot.
+ */
+struct SnapClockState {
+  uint32_t version = 1;
+  /// drift of the server clock relative to the local timebase
+  float drift_ppm = 0.0f;
+  /// drift of the output sample clock relative to the CPU clock
+  float output_ppm = 0.0f;
+};
+
+/**
+ * @brief Abstract storage for the clock model, so that the playback can start
+ * with the correct rate after a reboot.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapClockStore {
+ public:
+  /// Loads the stored state: returns false if there is none
+  virtual bool load(SnapClockState &state) = 0;
+  /// Stores the state
+  virtual bool save(const SnapClockState &state) = 0;
+};
+
+#if defined(ESP32)
+
+/**
+ * @brief Stores the clock model as blob in the NVS of the ESP32
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapClockStoreNVS : public SnapClockStore {
+ public:
+  SnapClockStoreNVS(const char *nameSpace = "snapclient",
+                    const char *key = "clock") {
+    name_space = nameSpace;
+    this->key = key;
+  }
+
+  bool load(SnapClockState &state) override {
+    nvs_handle_t handle;
+    if (nvs_open(name_space, NVS_READONLY, &handle) != ESP_OK) return false;
+    SnapClockState result;
+    size_t len = sizeof(result);
+    esp_err_t rc = nvs_get_blob(handle, key, &result, &len);
+    nvs_close(handle);
+    if (rc != ESP_OK || len != sizeof(result) ||
+        result.version != state.version)
+      return false;
+    state = result;
+    return true;
+  }
+
+  bool save(const SnapClockState &state) override {
+    nvs_handle_t handle;
+    if (nvs_open(name_space, NVS_READWRITE, &handle) != ESP_OK) {
+      ESP_LOGE(TAG, "nvs_open failed");
+      return false;
+    }
+    esp_err_t rc = nvs_set_blob(handle, key, &state, sizeof(state));
+    if (rc == ESP_OK) rc = nvs_commit(handle);
+    nvs_close(handle);
+    return rc == ESP_OK;
+  }
+
+ protected:
+  const char *TAG = "SnapClockStoreNVS";
+  const char *name_space;
+  const char *key;
+};
+
+#endif
+
+#if defined(__linux__)
+
+/**
+ * @brief Stores the clock model in a file
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapClockStoreFile : public SnapClockStore {
+ public:
+  SnapClockStoreFile(const char *path = "snapclient-clock.bin") {
+    this->path = path;
+  }
+
+  bool load(SnapClockState &state) override {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return false;
+    SnapClockState result;
+    size_t len = fread(&result, 1, sizeof(result), file);
+    fclose(file);
+    if (len != sizeof(result) || result.version != state.version) return false;
+    state = result;
+    return true;
+  }
+
+  bool save(const SnapClockState &state) override {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+      ESP_LOGE(TAG, "Could not open %s", path);
+      return false;
+    }
+    size_t len = fwrite(&state, 1, sizeof(state), file);
+    fclose(file);
+    return len == sizeof(state);
+  }
+
+ protected:
+  const char *TAG = "SnapClockStoreFile";
+  const char *path;
+};
+
+#endif
+
+}  // namespace snap_arduino
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <iomanip>
 #include <ctime>
+#include <string.h>
 
 namespace snap_arduino {
 
@@ -23,23 +24,26 @@ struct SnapAudioHeader {
   int32_t usec = 0;
   size_t size = 0;
   codec_type codec = NO_CODEC;
+  // position of the data in the chunk: chunks which are bigger than the
+  // buffer are passed on in parts and only the first part is synchronized
+  uint32_t offset = 0;
 
-  uint64_t operator-(SnapAudioHeader &h1) {
-    return (sec - h1.sec) * 1000000 + usec - h1.usec;
+  int64_t operator-(SnapAudioHeader &h1) {
+    return (int64_t)(sec - h1.sec) * 1000000 + usec - h1.usec;
   }
 };
 
-/// Recording of local_ms and server_ms
-struct SnapTimePoints {
-  uint32_t local_ms = millis();
-  uint32_t server_ms;
-  SnapTimePoints() = default;
-  SnapTimePoints(uint32_t serverMs){
-    server_ms = serverMs;
+/// @brief Non owning view on a range of characters e.g. in the receive buffer
+struct SnapView {
+  const char *data = nullptr;
+  uint32_t size = 0;
+
+  /// compares the content with a null terminated string
+  bool equals(const char *str) const {
+    return strlen(str) == size && memcmp(data, str, size) == 0;
   }
 };
 
-
 inline void checkHeap() {
 #if CONFIG_CHECK_HEAP && defined(ESP32)
   heap_caps_check_integrity_all(true);
@@ -0,0 +1,558 @@
+/**
+ * Linux only: asynchronous Client implementation based on epoll
+ */
+#pragma once
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Client.h"
+#include "SnapLogger.h"
+#include "SnapProcessor.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Client implementation for Linux which uses a non blocking socket.
+ * Each client has its own epoll instance, so that we can wait for the data
+ * w/o polling available(). The epoll fd stays valid across reconnects and
+ * can be added to the epoll set of a SnapEpollLoop. With startConnect() and
+ * finishConnect() the connection is established w/o blocking: the epoll fd
+ * signals when it has been completed. The kernel receive
+ * timestamps (SO_TIMESTAMPNS) of the last reads are recorded with their
+ * stream position.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapEpollClient : public Client {
+ public:
+  SnapEpollClient() { epoll_fd = epoll_create1(EPOLL_CLOEXEC); }
+
+  ~SnapEpollClient() {
+    stop();
+    if (epoll_fd >= 0) close(epoll_fd);
+  }
+
+  /// Connects and waits up to the connect timeout: use startConnect() to
+  /// avoid the blocking
+  int connect(IPAddress ip, uint16_t port) override {
+    if (!startConnect(ip, port)) return 0;
+    return waitConnect();
+  }
+
+  int connect(const char *host, uint16_t port) override {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    if (getaddrinfo(host, port_str, &hints, &result) != 0 ||
+        result == nullptr) {
+      ESP_LOGE(TAG, "Could not resolve %s", host);
+      return 0;
+    }
+    bool ok = startConnect(result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    return ok ? waitConnect() : 0;
+  }
+
+  /// Starts to connect w/o blocking: returns false if the connection could
+  /// not be started. The epoll fd signals when it can be completed with
+  /// finishConnect().
+  bool startConnect(IPAddress ip, uint16_t port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    uint8_t ip_bytes[4] = {ip[0], ip[1], ip[2], ip[3]};
+    memcpy(&address.sin_addr.s_addr, ip_bytes, 4);
+    return startConnect((sockaddr *)&address, sizeof(address));
+  }
+
+  /// Completes the connection w/o blocking: returns 1 if we are connected, 0
+  /// if the connection is still in progress and -1 if it failed
+  int finishConnect() {
+    if (is_connected) return 1;
+    if (!is_connecting) return -1;
+    if (!waitSocket(EPOLLOUT, 0)) {
+      if (millis() - connect_start_ms < (uint32_t)connect_timeout_ms) return 0;
+      ESP_LOGE(TAG, "connect timeout");
+      errno = ETIMEDOUT;
+      stop();
+      return -1;
+    }
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len);
+    if (error != 0) {
+      errno = error;
+      stop();
+      return -1;
+    }
+    setConnected();
+    return 1;
+  }
+
+  /// Returns true while the connection is in progress
+  bool isConnecting() { return is_connecting; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+
+  /// Writes all data: if the socket buffer is full we wait until it can
+  /// accept more data
+  size_t write(const uint8_t *data, size_t size) override {
+    size_t written = 0;
+    while (is_connected && written < size) {
+      ssize_t rc = ::send(sock, data + written, size - written, MSG_NOSIGNAL);
+      if (rc > 0) {
+        written += rc;
+      } else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!waitSocket(EPOLLOUT, write_timeout_ms)) break;
+      } else if (rc < 0 && errno == EINTR) {
+        continue;
+      } else {
+        setDisconnected();
+      }
+    }
+    return written;
+  }
+
+  int available() override {
+    if (!is_connected) return 0;
+    int result = 0;
+    if (ioctl(sock, FIONREAD, &result) < 0) return 0;
+    // w/o data we check if the server has closed the connection
+    if (result == 0) checkClosed();
+    return result;
+  }
+
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+
+  /// Reads the available data w/o blocking: returns -1 if there is no data.
+  /// With active timestamps we use one recvmsg() per timestamp slice, so that
+  /// the bytes of earlier segments do not get the timestamp of the last one.
+  int read(uint8_t *data, size_t size) override {
+    if (!is_timestamps || timestamp_slice == 0 || size <= timestamp_slice)
+      return receive(data, size);
+    size_t total = 0;
+    while (total < size) {
+      size_t len = std::min(size - total, timestamp_slice);
+      int rc = receive(data + total, len);
+      if (rc <= 0) break;
+      total += rc;
+      if ((size_t)rc < len) break;
+    }
+    return total > 0 ? total : -1;
+  }
+
+  int peek() override {
+    if (!is_connected) return -1;
+    uint8_t c;
+    return ::recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? c : -1;
+  }
+
+  void flush() override {}
+
+  void stop() override {
+    if (sock >= 0) {
+      // keep the errno of the failed operation for the logging
+      int error = errno;
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+      close(sock);
+      errno = error;
+    }
+    sock = -1;
+    is_connected = false;
+    is_connecting = false;
+  }
+
+  uint8_t connected() override { return is_connected; }
+
+  /// Provides the kernel receive time (local monotonic us) of the byte at the
+  /// indicated position of the stream: returns false if it is not available
+  bool receiveTime(uint64_t pos, int64_t &timeUs) {
+    for (int j = 0; j < timestamp_count; j++) {
+      // the entries are ordered by the stream position
+      ReceiveTimestamp &entry = timestamps[(timestamp_pos + j) % TIMESTAMPS];
+      if (pos >= entry.start_pos && pos < entry.end_pos) {
+        timeUs = entry.time_us;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Activates the kernel receive timestamps (default true)
+  void setReceiveTimestamps(bool active) { is_timestamps = active; }
+
+  /// Defines the max number of bytes per recvmsg() when the timestamps are
+  /// active (default 1460 which is the usual TCP segment size): 0 reads all
+  /// requested bytes with one call
+  void setTimestampSlice(size_t bytes) { timestamp_slice = bytes; }
+
+  operator bool() override { return is_connected; }
+
+  /// Waits until data can be read: returns true if data is available
+  bool waitReadable(int timeoutMs) {
+    if (!is_connected && !is_connecting) {
+      // nothing to wait for
+      delay(timeoutMs);
+      return false;
+    }
+    epoll_event event;
+    int rc = epoll_wait(epoll_fd, &event, 1, timeoutMs);
+    // errors while connecting are reported by finishConnect()
+    if (rc > 0 && is_connected && (event.events & (EPOLLERR | EPOLLHUP))) {
+      setDisconnected();
+    }
+    // the server has closed the connection and all data has been read
+    if (rc > 0 && (event.events & EPOLLRDHUP) && available() == 0) {
+      setDisconnected();
+    }
+    return rc > 0;
+  }
+
+  /// Provides the epoll fd which signals readability
+  int epollFD() { return epoll_fd; }
+
+  /// Defines the max time we wait for the connection
+  void setConnectTimeout(int ms) { connect_timeout_ms = ms; }
+
+  /// Defines the max time we wait when the send buffer is full
+  void setWriteTimeout(int ms) { write_timeout_ms = ms; }
+
+ protected:
+  const char *TAG = "SnapEpollClient";
+  int sock = -1;
+  int epoll_fd = -1;
+  bool is_connected = false;
+  bool is_connecting = false;
+  uint32_t connect_start_ms = 0;
+  int connect_timeout_ms = 5000;
+  int write_timeout_ms = 1000;
+  struct ReceiveTimestamp {
+    uint64_t start_pos;
+    uint64_t end_pos;
+    int64_t time_us;
+  };
+  static const int TIMESTAMPS = 32;
+  ReceiveTimestamp timestamps[TIMESTAMPS];
+  int timestamp_pos = 0;
+  int timestamp_count = 0;
+  uint64_t received_bytes = 0;
+  bool is_timestamps = true;
+  size_t timestamp_slice = 1460;
+
+  /// one recvmsg() w/o blocking which records the receive timestamp
+  int receive(uint8_t *data, size_t size) {
+    if (!is_connected) return -1;
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+    char control[CMSG_SPACE(sizeof(timespec))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t rc = ::recvmsg(sock, &msg, MSG_DONTWAIT);
+    // one timestamp per recvmsg: it is the one of the last segment
+    if (rc > 0) {
+      received_bytes += rc;
+      recordTimestamp(msg, rc);
+    }
+    if (rc == 0) {
+      // orderly shutdown by the server
+      setDisconnected();
+      return -1;
+    }
+    if (rc < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        setDisconnected();
+      }
+      return -1;
+    }
+    return rc;
+  }
+
+  /// records the timestamp of the last recvmsg converted from the real
+  /// time to the monotonic clock
+  void recordTimestamp(msghdr &msg, size_t len) {
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+        continue;
+      timespec ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      timespec real_now, mono_now;
+      clock_gettime(CLOCK_REALTIME, &real_now);
+      clock_gettime(CLOCK_MONOTONIC, &mono_now);
+      int64_t age_us = toUs(real_now) - toUs(ts);
+      ReceiveTimestamp entry;
+      entry.end_pos = received_bytes;
+      entry.start_pos = received_bytes - len;
+      entry.time_us = toUs(mono_now) - std::max((int64_t)0, age_us);
+      if (timestamp_count < TIMESTAMPS) {
+        timestamps[(timestamp_pos + timestamp_count++) % TIMESTAMPS] = entry;
+      } else {
+        timestamps[timestamp_pos] = entry;
+        timestamp_pos = (timestamp_pos + 1) % TIMESTAMPS;
+      }
+    }
+  }
+
+  static int64_t toUs(const timespec &ts) {
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  bool startConnect(sockaddr *address, socklen_t len) {
+    stop();
+    sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) return false;
+    // we write complete frames, so there is no need to wait for more data
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (is_timestamps) {
+      setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag));
+    }
+    received_bytes = 0;
+    timestamp_pos = 0;
+    timestamp_count = 0;
+
+    int rc = ::connect(sock, address, len);
+    if (rc < 0 && errno != EINPROGRESS) {
+      stop();
+      return false;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.fd = sock;
+    if (rc == 0) {
+      event.events = EPOLLIN | EPOLLRDHUP;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event);
+      is_connected = true;
+      return true;
+    }
+    // the socket gets writable when the connection has been completed
+    event.events = EPOLLOUT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event);
+    is_connecting = true;
+    connect_start_ms = millis();
+    return true;
+  }
+
+  /// waits up to the connect timeout for the completion of the connection
+  int waitConnect() {
+    if (is_connecting) waitSocket(EPOLLOUT, connect_timeout_ms);
+    int rc = finishConnect();
+    if (rc == 0) {
+      errno = ETIMEDOUT;
+      stop();
+    }
+    return rc > 0 ? 1 : 0;
+  }
+
+  /// from now on we only wait for incoming data
+  void setConnected() {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = sock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &event);
+    is_connecting = false;
+    is_connected = true;
+  }
+
+  /// a readable socket w/o data indicates that the server has closed the
+  /// connection
+  void checkClosed() {
+    uint8_t c;
+    ssize_t rc = ::recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != EINTR)) {
+      setDisconnected();
+    }
+  }
+
+  /// waits for the indicated event on the socket only
+  bool waitSocket(uint32_t events, int timeoutMs) {
+    int wait_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (wait_fd < 0) return false;
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = sock;
+    epoll_ctl(wait_fd, EPOLL_CTL_ADD, sock, &event);
+    int rc = epoll_wait(wait_fd, &event, 1, timeoutMs);
+    close(wait_fd);
+    return rc > 0 && (event.events & events);
+  }
+
+  void setDisconnected() {
+    if (is_connected) ESP_LOGW(TAG, "disconnected");
+    is_connected = false;
+    // the closed socket must not wake up the epoll loop until the reconnect
+    int error = errno;
+    if (sock >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, nullptr);
+    errno = error;
+  }
+};
+
+/**
+ * @brief Processor which waits on the epoll instance of the client instead of
+ * using a fixed delay, so it is woken up as soon as data arrives. The
+ * connection is established w/o blocking. Each processor needs its own
+ * SnapOutput, which should use its own SnapTime if there are multiple
+ * connections.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapProcessorEpoll : public SnapProcessor {
+ public:
+  SnapProcessorEpoll(SnapEpollClient &client, SnapOutput &output)
+      : SnapProcessor(output) {
+    init(client);
+  }
+
+  /// Defines the max time we wait for data in each loop: 0 never waits,
+  /// which is needed if the processor is driven by a SnapEpollLoop
+  void setWaitTimeout(int ms) { wait_timeout_ms = ms; }
+
+ protected:
+  SnapEpollClient *p_epoll_client = nullptr;
+  int wait_timeout_ms = 20;
+
+  void init(SnapEpollClient &client) {
+    p_epoll_client = &client;
+    setClient(client);
+    setFastLoop(true);
+  }
+
+  /// The connection is completed when the socket gets writable: we never
+  /// wait for it
+  bool connectClient() override {
+    if (p_epoll_client->connected()) return true;
+    if (!p_epoll_client->isConnecting()) {
+      if (!isReconnectDue()) return false;
+      if (!p_epoll_client->startConnect(server_ip, server_port)) {
+        ESP_LOGE(TAG, "Socket connect failed (errno = %d)", errno);
+        scheduleReconnect();
+        return false;
+      }
+    }
+    int rc = p_epoll_client->finishConnect();
+    if (rc < 0) {
+      ESP_LOGE(TAG, "Socket connect failed (errno = %d)", errno);
+      scheduleReconnect();
+      return false;
+    }
+    if (rc == 0) return false;
+    reconnect_delay_ms = 0;
+    return true;
+  }
+
+  /// we wait for the data instead of using a delay: pending silence is
+  /// written w/o waiting
+  void processExt() override {
+    concealUnderrun();
+    if (wait_timeout_ms > 0 && !p_snap_output->isWritePending()) p_epoll_client->waitReadable(wait_timeout_ms);
+  }
+
+  /// we use the kernel receive timestamps
+  bool receiveTime(uint64_t streamPos, int64_t &timeUs) override {
+    return p_epoll_client->receiveTime(streamPos, timeUs);
+  }
+};
+
+/**
+ * @brief Serves multiple connections from one thread: the processors are
+ * only called when their client has data or when the timeout has expired
+ * (e.g. to send time messages or to reconnect). Each connection needs its
+ * own SnapOutput with its own SnapTime.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapEpollLoop {
+ public:
+  SnapEpollLoop() { epoll_fd = epoll_create1(EPOLL_CLOEXEC); }
+
+  ~SnapEpollLoop() {
+    if (epoll_fd >= 0) close(epoll_fd);
+  }
+
+  /// Adds a processor with its client: returns false if the output or the
+  /// time model is shared with another connection
+  bool add(SnapProcessorEpoll &processor, SnapEpollClient &client) {
+    SnapOutput &output = processor.snapOutput();
+    for (auto *entry : entries) {
+      if (&entry->snapOutput() == &output ||
+          &entry->snapOutput().snapTime() == &output.snapTime()) {
+        ESP_LOGE(TAG, "Each connection needs its own SnapOutput and SnapTime");
+        return false;
+      }
+    }
+    processor.setWaitTimeout(0);
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = entries.size();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.epollFD(), &event) != 0) {
+      return false;
+    }
+    entries.push_back(&processor);
+    return true;
+  }
+
+  /// Defines the interval in which all processors are called
+  void setTimeout(int ms) { timeout_ms = ms; }
+
+  /// Waits for data and processes the ready connections
+  void doLoop() {
+    epoll_event events[16];
+    int count = epoll_wait(epoll_fd, events, 16, timeout_ms);
+    for (int j = 0; j < count; j++) {
+      entries[events[j].data.u32]->doLoop();
+    }
+    uint32_t time_ms = millis();
+    if (count <= 0 || time_ms - last_all_ms >= (uint32_t)timeout_ms) {
+      last_all_ms = time_ms;
+      for (auto *processor : entries) processor->doLoop();
+    }
+  }
+
+ protected:
+  const char *TAG = "SnapEpollLoop";
+  int epoll_fd = -1;
+  int timeout_ms = 100;
+  uint32_t last_all_ms = 0;
+  std::vector<SnapProcessorEpoll *> entries;
+};
+
+}  // namespace snap_arduino
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * Minimal JSON support for the Snapcast messages
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "SnapCommon.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Single pass, allocation free JSON tokenizer which provides the key
+ * value pairs of an object (or the elements of an array) as views into the
+ * original text. Nested objects and arrays are returned as a whole and can be
+ * parsed with a new reader. Keys are provided without quotes, string values
+ * with quotes, so that the converters can check the type.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapJsonReader {
+ public:
+  SnapJsonReader(const char *json, size_t len) { begin(json, len); }
+
+  SnapJsonReader(const SnapView &json) { begin(json.data, json.size); }
+
+  /// (Re)starts the parsing of the indicated text
+  void begin(const char *json, size_t len) {
+    this->json = json;
+    this->len = json == nullptr ? 0 : len;
+    pos = 0;
+    is_error = false;
+    is_end = false;
+    is_started = false;
+  }
+
+  /// Provides the next key value pair of an object: returns false at the end
+  bool next(SnapView &key, SnapView &value) {
+    if (!nextEntry('{', '}')) return false;
+    if (!readString(key) || !expect(':') || !readValue(value)) {
+      return setError();
+    }
+    // key without quotes
+    key.data++;
+    key.size -= 2;
+    return true;
+  }
+
+  /// Provides the next element of an array: returns false at the end
+  bool next(SnapView &value) {
+    if (!nextEntry('[', ']')) return false;
+    if (!readValue(value)) return setError();
+    return true;
+  }
+
+  /// Searches the value for the indicated key (from the start)
+  bool find(const char *name, SnapView &value) {
+    begin(json, len);
+    SnapView key;
+    while (next(key, value)) {
+      if (key.equals(name)) return true;
+    }
+    return false;
+  }
+
+  /// Returns true if the text is not valid JSON
+  bool isError() { return is_error; }
+
+  /// Converts a number value: returns false if it does not fit into an
+  /// int32_t
+  static bool toInt(const SnapView &value, int32_t &result) {
+    size_t j = 0;
+    bool negative = value.size > 0 && value.data[0] == '-';
+    if (negative) j++;
+    if (j >= value.size) return false;
+    uint32_t limit = negative ? 2147483648u : 2147483647u;
+    uint32_t number = 0;
+    for (; j < value.size; j++) {
+      char ch = value.data[j];
+      // ignore any fractional part
+      if (ch == '.' || ch == 'e' || ch == 'E') break;
+      if (ch < '0' || ch > '9') return false;
+      uint32_t digit = ch - '0';
+      if (number > (limit - digit) / 10) return false;
+      number = number * 10 + digit;
+    }
+    result = negative ? (int32_t)(-(int64_t)number) : (int32_t)number;
+    return true;
+  }
+
+  /// Converts a true/false value
+  static bool toBool(const SnapView &value, bool &result) {
+    if (value.equals("true")) {
+      result = true;
+      return true;
+    }
+    if (value.equals("false")) {
+      result = false;
+      return true;
+    }
+    return false;
+  }
+
+  /// Copies a string value w/o quotes to a null terminated string resolving
+  /// the escape sequences: returns false if the value is not a string
+  static bool toString(const SnapView &value, char *str, size_t len) {
+    if (len == 0 || value.size < 2 || value.data[0] != '"') return false;
+    size_t out = 0;
+    for (size_t j = 1; j < value.size - 1 && out < len - 1; j++) {
+      char ch = value.data[j];
+      if (ch == '\\' && j + 1 < value.size - 1) {
+        ch = value.data[++j];
+        switch (ch) {
+          case 'n':
+            ch = '\n';
+            break;
+          case 't':
+            ch = '\t';
+            break;
+          case 'r':
+            ch = '\r';
+            break;
+          case 'b':
+            ch = '\b';
+            break;
+          case 'f':
+            ch = '\f';
+            break;
+          case 'u':
+            // we do not support unicode escapes
+            j += 4;
+            ch = '?';
+            break;
+          default:
+            // \" \\ \/
+            break;
+        }
+      }
+      str[out++] = ch;
+    }
+    str[out] = '\0';
+    return true;
+  }
+
+ protected:
+  const char *json = nullptr;
+  size_t len = 0;
+  size_t pos = 0;
+  bool is_error = false;
+  bool is_end = false;
+  bool is_started = false;
+
+  bool setError() {
+    is_error = true;
+    is_end = true;
+    return false;
+  }
+
+  void skipWhitespace() {
+    while (pos < len && (json[pos] == ' ' || json[pos] == '\t' ||
+                         json[pos] == '\n' || json[pos] == '\r')) {
+      pos++;
+    }
+  }
+
+  bool expect(char ch) {
+    skipWhitespace();
+    if (pos >= len || json[pos] != ch) return false;
+    pos++;
+    return true;
+  }
+
+  /// handles the opening, separator and closing characters
+  bool nextEntry(char open, char close) {
+    if (is_end) return false;
+    if (!is_started) {
+      is_started = true;
+      if (!expect(open)) return setError();
+      skipWhitespace();
+      if (pos < len && json[pos] == close) {
+        pos++;
+        is_end = true;
+        return false;
+      }
+      return true;
+    }
+    skipWhitespace();
+    if (pos < len && json[pos] == close) {
+      pos++;
+      is_end = true;
+      return false;
+    }
+    if (!expect(',')) return setError();
+    return true;
+  }
+
+  /// reads a string including the quotes
+  bool readString(SnapView &result) {
+    skipWhitespace();
+    if (pos >= len || json[pos] != '"') return false;
+    size_t start = pos++;
+    while (pos < len && json[pos] != '"') {
+      if (json[pos] == '\\') pos++;
+      pos++;
+    }
+    if (pos >= len) return false;
+    pos++;
+    result.data = json + start;
+    result.size = pos - start;
+    return true;
+  }
+
+  /// reads any value: nested objects and arrays are provided as a whole
+  bool readValue(SnapView &result) {
+    skipWhitespace();
+    if (pos >= len) return false;
+    char ch = json[pos];
+    if (ch == '"') return readString(result);
+
+    size_t start = pos;
+    if (ch == '{' || ch == '[') {
+      int level = 0;
+      while (pos < len) {
+        ch = json[pos];
+        if (ch == '"') {
+          SnapView str;
+          if (!readString(str)) return false;
+          continue;
+        }
+        if (ch == '{' || ch == '[') level++;
+        if (ch == '}' || ch == ']') level--;
+        pos++;
+        if (level == 0) break;
+      }
+      if (level != 0) return false;
+    } else {
+      // number, true, false or null
+      while (pos < len && json[pos] != ',' && json[pos] != '}' &&
+             json[pos] != ']' && json[pos] != ' ' && json[pos] != '\t' &&
+             json[pos] != '\n' && json[pos] != '\r') {
+        pos++;
+      }
+      if (pos == start) return false;
+    }
+    result.data = json + start;
+    result.size = pos - start;
+    return true;
+  }
+};
+
+}  // namespace snap_arduino
@@ -3,21 +3,42 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include <atomic>
+
 #include "Arduino.h"  // for ESP.getPsramSize()
 #include "AudioTools.h"
 #include "SnapCommon.h"
 #include "SnapConfig.h"
 #include "SnapLogger.h"
+#include "SnapOutputClock.h"
+#include "SnapPlaybackStream.h"
+#include "SnapPolyphaseResampleStream.h"
 #include "SnapTime.h"
 #include "SnapTimeSync.h"
+#include "SnapVolumeResampleStream.h"
 
 namespace snap_arduino {
 
 class SnapProcessor;
 
+/**
+ * @brief Result of the playout check of a buffered chunk
+ */
+enum SnapPlayout {
+  /// the chunk is due and can be written to the decoder
+  SnapPlayoutWrite,
+  /// the chunk is early: keep it and check again later
+  SnapPlayoutWait,
+  /// the chunk is too late and must be discarded
+  SnapPlayoutDrop
+};
+
 /**
  * @brief Simple Output Class which uses the AudioTools to build an output chain
- * with volume control and a resampler
+ * with a playback alignment stage, volume control and a resampler. For 16 bit
+ * audio the volume control and the resampler can be replaced by a fused
+ * single pass stage and a polyphase resampler can be used which also converts
+ * the sample rate if the output needs a fixed rate.
  * @author Phil Schatzmann
  * @version 0.1
  * @date 2023-10-28
@@ -33,11 +54,26 @@ class SnapOutput : public AudioInfoSupport {
   /// task
   virtual bool begin() {
     ESP_LOGI(TAG, "begin");
-    is_sync_started = false;
+    restart_done = restart_request.load(std::memory_order_acquire);
+    is_restart_cold = false;
+    resetSync(false);
     return audioBegin();
   }
 
-  /// Writes audio data to the queue
+  /// Restarts the playback synchronization (e.g. after a reconnect) keeping
+  /// the decoder and output chain: with isWarm = false the clock model is
+  /// measured again. The restart is only requested here and applied by the
+  /// task which writes the audio.
+  void restartSync(bool isWarm = true) {
+    ESP_LOGI(TAG, "restartSync: %s", isWarm ? "warm" : "cold");
+    if (!isWarm) is_restart_cold = true;
+    restart_request.fetch_add(1, std::memory_order_release);
+  }
+
+  /// Writes audio data to the queue: if silence needs to be played before
+  /// the audio (e.g. to align the start), the data is kept back. In this case
+  /// the data must stay valid and writePending() must be called until it
+  /// returns false.
   virtual size_t write(const uint8_t *data, size_t size) {
     ESP_LOGD(TAG, "%zu", size);
     // only start to proces data after we received codec header
@@ -45,14 +81,45 @@ class SnapOutput : public AudioInfoSupport {
       ESP_LOGI(TAG, "not started");
       return 0;
     }
+    updateRestart();
 
-    if (!synchronizePlayback()) {
-      return size;
+    // the following parts of a chunk share the decision of the first part
+    if (header.offset == 0) {
+      chunk_playout =
+          synchronizeChunk(header) ? SnapPlayoutWrite : SnapPlayoutDrop;
     }
+    if (chunk_playout != SnapPlayoutWrite) return size;
 
+    if (playback.pendingSilenceFrames() > 0) {
+      p_pending_data = data;
+      pending_size = size;
+      return size;
+    }
     return audioWrite(data, size);
   }
 
+  /// Writes the next slice of the silence before the audio which was kept
+  /// back by write(): returns true as long as the audio is kept back
+  bool writePending() {
+    updateRestart();
+    if (p_pending_data == nullptr) return false;
+    if (playback.writeSilenceSlice()) return true;
+    const uint8_t *data = p_pending_data;
+    p_pending_data = nullptr;
+    audioWrite(data, pending_size);
+    return false;
+  }
+
+  /// Returns true if write() keeps back audio data
+  bool isWritePending() { return p_pending_data != nullptr; }
+
+  /// Writes the next slice of the silence which is pending before the next
+  /// audio: returns true if there is still silence pending
+  bool writeSilence() {
+    updateRestart();
+    return playback.writeSilenceSlice();
+  }
+
   /// Provides info about the audio data
   virtual bool writeHeader(SnapAudioHeader &header) {
     this->header = header;
@@ -67,16 +134,17 @@ class SnapOutput : public AudioInfoSupport {
     this->vol = vol;
     ESP_LOGI(TAG, "Volume: %f", this->vol);
     vol_stream.setVolume(this->vol * vol_factor);
+    fused_stream.setVolume(this->vol * vol_factor);
   }
 
   /// provides the actual volume
   float volume() { return vol; }
 
-  /// mute / unmute
+  /// mute / unmute: the playback stage ramps the gain, so this does not
+  /// write anything to the output
   void setMute(bool mute) {
     is_mute = mute;
-    setVolume(mute ? 0.0f : vol);
-    audioWriteSilence();
+    playback.setMute(mute);
   }
 
   /// checks if volume is mute
@@ -88,15 +156,56 @@ class SnapOutput : public AudioInfoSupport {
   /// Defines the audio output chain to the final output
   void setOutput(AudioOutput &output) {
     this->out = &output;  // final output
-    resample.setOutput(output);
-    vol_stream.setStream(resample);  // adjust volume
-    decoder_stream.setStream(&vol_stream);  // decode to pcm
+    output_clock.setOutput(output);  // measure the output rate
+    resample.setOutput(output_clock);
+    polyphase.setOutput(output_clock);
+    is_resampling = true;
+    decoder_stream.setStream(&playback);  // decode to pcm
 
     // synchronized audio information
     AudioInfo info = output.audioInfo();
+    output_clock.setAudioInfo(info);
     resample.begin(info, info);
+    polyphase.setAudioInfo(info);
     vol_stream.setAudioInfo(info);
+    fused_stream.setAudioInfo(info);
+    playback.setAudioInfo(info);
     decoder_stream.setAudioInfo(info);
+    audio_info = info;
+    // align start -> volume -> resample
+    updateChain();
+  }
+
+  /// Uses a single pass volume and resample stage for 16 bit audio instead of
+  /// the VolumeStream and ResampleStream (which are used as fallback)
+  void setFusedStage(bool active) {
+    is_fused = active;
+    updateChain();
+  }
+
+  /// Returns true if the fused volume and resample stage is used
+  bool isFusedStage() { return is_fused && audio_info.bits_per_sample == 16; }
+
+  /// Defines a fixed sample rate for the output: 16 bit audio with a
+  /// different rate (e.g. 44100 from the server and a 48000 output) is
+  /// converted by the polyphase resampler. Other audio is output with its
+  /// own rate. 0 (default) uses the rate of the audio. The rate is applied by
+  /// the next begin() or setAudioInfo().
+  void setOutputSampleRate(int rate) { output_rate = rate; }
+
+  /// Uses the polyphase resampler with the indicated preset for the drift
+  /// correction instead of the linear interpolating ResampleStream
+  void setResampleQuality(SnapResampleQuality quality) {
+    polyphase.setQuality(quality);
+    is_polyphase = true;
+    updateChain();
+  }
+
+  /// Provides the audio info of the final output
+  AudioInfo outputInfo() {
+    AudioInfo result = audio_info;
+    if (isRateConversion()) result.sample_rate = output_rate;
+    return result;
   }
 
   AudioOutput &getOutput() { return *out; }
@@ -112,20 +221,89 @@ class SnapOutput : public AudioInfoSupport {
              info.channels, info.bits_per_sample);
     audio_info = info;
     if (is_audio_begin_called) {
+      playback.setAudioInfo(info);
       vol_stream.setAudioInfo(info);
-      out->setAudioInfo(info);
+      fused_stream.setAudioInfo(info);
+      fused_stream.begin();
+      polyphase.setAudioInfo(info);
+      polyphase.setOutputRate(output_rate);
+      polyphase.begin();
+      checkOutputRate();
+      out->setAudioInfo(outputInfo());
+      output_clock.setAudioInfo(outputInfo());
+      // the rate conversion might have changed
+      setPlaybackFactor(playback_factor);
     }
+    updateChain();
   }
 
   AudioInfo audioInfo() { return audio_info; }
 
+  /// Provides the output sample clock which can be used as timebase for the
+  /// time synchronization: snapTimeSync().setTimebase(outputClock())
+  SnapOutputClock &outputClock() { return output_clock; }
+
   /// Defines the time synchronization logic
   void setSnapTimeSync(SnapTimeSync &timeSync) { p_snap_time_sync = &timeSync; }
 
   SnapTimeSync &snapTimeSync() { return *p_snap_time_sync; }
 
+  /// Defines the model which translates between the local and the server
+  /// time: by default all outputs share SnapTime::instance()
+  void setSnapTime(SnapTime &time) { p_snap_time = &time; }
+
+  /// Provides the model which translates between local and server time
+  SnapTime &snapTime() { return *p_snap_time; }
+
+  /// Returns true if the time synchronization logic has been defined
+  bool hasSnapTimeSync() { return p_snap_time_sync != nullptr; }
+
   bool isStarted() { return is_audio_begin_called; }
 
+  /// Defines how the playback is started (default SnapStartAligned)
+  void setStartMode(SnapStartMode mode) { start_mode = mode; }
+
+  /// Soft sync: clock differences up to the indicated ppm are corrected by
+  /// dropping or duplicating single frames instead of resampling. 0 disables
+  /// the soft sync.
+  void setSoftSync(float maxPPM) { soft_sync_max_ppm = maxPPM; }
+
+  /// Defines by how much a chunk can be trimmed if it is already late: the
+  /// first chunk (SnapStartAligned only) and buffered chunks at playout
+  void setMaxStartTrim(int ms) { max_start_trim_ms = ms; }
+
+  /// Defines the tolerance for buffered chunks at playout: chunks which are
+  /// due later than earlyMs are kept back, chunks which are later than lateMs
+  /// are shortened
+  void setPlayoutTolerance(int earlyMs, int lateMs) {
+    playout_early_ms = earlyMs;
+    playout_late_ms = lateMs;
+  }
+
+  /// Returns true if audio with the indicated timestamp can not be used any
+  /// more to start the playback
+  bool isExpired(int32_t sec, int32_t usec) {
+    return isTooLate(getDelayUs(sec, usec));
+  }
+
+  /// Number of buffered chunks which were dropped at playout because they
+  /// were too late
+  uint32_t droppedChunks() { return dropped_chunks; }
+
+  /// Number of detected gaps in the chunk timestamps
+  uint32_t gapCount() { return gap_count; }
+
+  /// Number of buffer underruns which were concealed
+  uint32_t underrunCount() { return underrun_count; }
+
+  /// Defines the min difference of the chunk timestamp to the end of the
+  /// decoded audio which is treated as gap (default CONFIG_SNAPCAST_GAP_MIN_MS)
+  void setGapMin(int ms) { gap_min_ms = ms; }
+
+  /// Defines the number of frames for the fade out and in around inserted
+  /// silence
+  void setFadeFrames(uint32_t frames) { playback.setFadeFrames(frames); }
+
   // writes the audio data to the decoder
   size_t audioWrite(const void *src, size_t size) {
     ESP_LOGI(TAG, "audioWrite: %zu", size);
@@ -140,40 +318,136 @@ class SnapOutput : public AudioInfoSupport {
 
   /// start to play audio only in valid server time: return false if to be
   /// ignored - update playback speed
-  bool synchronizePlayback() {
+  bool synchronizePlayback() { return synchronizePlayback(header); }
+
+  /// start to play the audio with the indicated header only in valid server
+  /// time: return false if to be ignored - update playback speed
+  bool synchronizePlayback(SnapAudioHeader &header) {
     bool result = true;
     assert(p_snap_time_sync!=nullptr);
 
     SnapTimeSync &ts = *p_snap_time_sync;
 
     // calculate how long we need to wait to playback the audio
-    auto delay_ms = getDelayMs();
+    int64_t delay_us = getDelayUs(header.sec, header.usec);
 
     if (!is_sync_started) {
-      ts.begin(audio_info.sample_rate);
+      if (!is_warm_start) ts.begin(audio_info.sample_rate);
 
       // start audio when first package in the future becomes valid
-      result = synchronizeOnStart(delay_ms);
+      result = synchronizeOnStart(delay_us);
     } else {
-      // provide the actual delay to the synch
-      ts.updateActualDelay(delay_ms);
-
-      if (ts.isSync()) {
-        // update speed
-        float current_factor = playbackFactor();
-        float new_factor = p_snap_time_sync->getFactor();
-        if (new_factor != current_factor) {
-          setPlaybackFactor(new_factor);
-        }
-      }
+      updatePlaybackSpeed(delay_us);
     }
     return result;
   }
 
+  /// Checks a buffered chunk against the server time when it is about to be
+  /// played: late chunks are dropped or shortened and early chunks are kept
+  /// back, so that the sync is enforced where the audio leaves the buffer
+  SnapPlayout playout(SnapAudioHeader &header) {
+    updateRestart();
+    // the following parts of a chunk share the decision of the first part
+    if (header.offset > 0) return chunk_playout;
+    chunk_playout = playoutChunk(header);
+    return chunk_playout;
+  }
+
+  /// Synchronizes the start with the first part of a chunk or checks it
+  /// against the stream position: returns false if it is to be dropped
+  bool synchronizeChunk(SnapAudioHeader &header) {
+    if (!is_sync_started) {
+      if (!synchronizePlayback(header)) return false;
+      updateStreamPosition(header);
+      return true;
+    }
+    return synchronizeStream(header);
+  }
+
+  /// Checks the first part of a buffered chunk
+  SnapPlayout playoutChunk(SnapAudioHeader &header) {
+    if (!is_audio_begin_called) return SnapPlayoutDrop;
+    int64_t delay_us = getDelayUs(header.sec, header.usec);
+    int delay_ms = delay_us / 1000;
+
+    // w/o alignment we wait until the first chunk becomes due
+    if (delay_ms > playout_early_ms &&
+        (is_sync_started || start_mode == SnapStartImmediate)) {
+      ESP_LOGD(TAG, "early chunk: delay %d ms", delay_ms);
+      return SnapPlayoutWait;
+    }
+    return synchronizeChunk(header) ? SnapPlayoutWrite : SnapPlayoutDrop;
+  }
+
+  /// Checks a chunk after the start of the playback: late chunks are dropped
+  /// or shortened, gaps are filled with silence and inserted concealment is
+  /// removed again. Returns false if the chunk is to be dropped.
+  bool synchronizeStream(SnapAudioHeader &header) {
+    int64_t delay_us = getDelayUs(header.sec, header.usec);
+    int delay_ms = delay_us / 1000;
+    if (isTooLate(delay_us + toMicros(concealed_frames))) {
+      ESP_LOGW(TAG, "late chunk dropped: delay %d ms", delay_ms);
+      dropped_chunks++;
+      // the stream continues with the next chunk
+      has_stream_pos = false;
+      return false;
+    }
+    // fill gaps with silence and remove inserted concealment
+    delay_us -= updateStreamPosition(header);
+    delay_ms = delay_us / 1000;
+    if (delay_ms < -playout_late_ms) {
+      // remove the part which should already have been played
+      ESP_LOGI(TAG, "late chunk trimmed: delay %d ms", delay_ms);
+      playback.trimFrames(playback.toFrames(-delay_us));
+    }
+    updatePlaybackSpeed(delay_us);
+    return true;
+  }
+
   uint64_t getLastWriteTime() {
     return time_last_write;
   }
 
+  /// Returns true after the first valid audio data has been played
+  bool isSyncStarted() { return is_sync_started; }
+
+  /// Calculate the delay in ms for the indicated server timestamp
+  int getDelayMs(int32_t sec, int32_t usec) {
+    return getDelayUs(sec, usec) / 1000;
+  }
+
+  /// Calculate the delay in us for the indicated server timestamp
+  int64_t getDelayUs(int32_t sec, int32_t usec) {
+    return getDelayUs(p_snap_time->toMicros(sec, usec));
+  }
+
+  /// Calculate the delay in us for the indicated server time in us
+  int64_t getDelayUs(int64_t msg_time) {
+    assert(p_snap_time_sync!=nullptr);
+    int64_t server_time = p_snap_time->serverMicros();
+    // wait for the audio to become valid
+    int64_t diff_us = msg_time - server_time;
+    return diff_us + (int64_t)p_snap_time_sync->getStartDelay() * 1000;
+  }
+
+  /// Called by the processors when no chunk can be played: when the decoded
+  /// audio is due, the output is filled with silence which is removed again
+  /// from the next chunk
+  void writeUnderrun() {
+    updateRestart();
+    if (!is_sync_started || !has_stream_pos || audio_info.sample_rate <= 0)
+      return;
+    int64_t end_us = streamEndUs() + toMicros(concealed_frames);
+    if (getDelayUs(end_us) > -(int64_t)playout_late_ms * 1000) return;
+    if (concealed_frames == 0) {
+      ESP_LOGW(TAG, "buffer underrun");
+      underrun_count++;
+    }
+    uint32_t frames =
+        playback.toFrames((int64_t)CONFIG_SNAPCAST_CONCEAL_MS * 1000);
+    concealed_frames += playback.writeConcealment(frames);
+  }
+
   /// checks if the audio is still playing
   bool isActive(uint16_t timeout=1000){
     return (time_last_write + timeout) >= millis();
@@ -184,17 +458,53 @@ class SnapOutput : public AudioInfoSupport {
   AudioOutput *out = nullptr;
   AudioInfo audio_info;
   EncodedAudioStream decoder_stream;
+  SnapPlaybackStream playback;
+  SnapOutputClock output_clock;
   VolumeStream vol_stream;
   ResampleStream resample;
+  SnapVolumeResampleStream fused_stream;
+  bool is_fused = false;
+  SnapPolyphaseResampleStream polyphase;
+  bool is_polyphase = false;
+  int output_rate = 0;
   float vol = 1.0;         // volume in the range 0.0 - 1.0
   float vol_factor = 1.0;  //
   bool is_mute = false;
   SnapAudioHeader header;
-  SnapTime &snap_time = SnapTime::instance();
+  SnapTime *p_snap_time = &SnapTime::instance();
   SnapTimeSync *p_snap_time_sync = nullptr;
-  bool is_sync_started = false;
+  // read by the network task: the other sync state is only used by the task
+  // which writes the audio
+  std::atomic<bool> is_sync_started{false};
+  bool is_warm_start = false;
+  // restart requested by restartSync()
+  std::atomic<uint32_t> restart_request{0};
+  std::atomic<bool> is_restart_cold{false};
+  uint32_t restart_done = 0;
   bool is_audio_begin_called = false;
+  // audio which waits for the silence before it
+  const uint8_t *p_pending_data = nullptr;
+  size_t pending_size = 0;
+  // decision for the first part of the actual chunk
+  SnapPlayout chunk_playout = SnapPlayoutDrop;
   uint64_t time_last_write = 0;
+  SnapStartMode start_mode = SnapStartAligned;
+  int max_start_trim_ms = 100;
+  int playout_early_ms = CONFIG_SNAPCAST_PLAYOUT_EARLY_MS;
+  int playout_late_ms = CONFIG_SNAPCAST_PLAYOUT_LATE_MS;
+  uint32_t dropped_chunks = 0;
+  // position of the decoded audio in server time
+  bool has_stream_pos = false;
+  int64_t stream_base_us = 0;
+  uint64_t stream_base_frames = 0;
+  uint32_t concealed_frames = 0;
+  int gap_min_ms = CONFIG_SNAPCAST_GAP_MIN_MS;
+  int gap_max_fill_ms = 1000;
+  uint32_t gap_count = 0;
+  uint32_t underrun_count = 0;
+  float playback_factor = 1.0f;
+  float soft_sync_max_ppm = 0.0f;
+  bool is_resampling = true;
 
   /// setup of all audio objects
   bool audioBegin() {
@@ -216,10 +526,21 @@ class SnapOutput : public AudioInfoSupport {
     vol_cfg.allow_boost = true;
     vol_stream.begin(vol_cfg);
     vol_stream.setVolume(vol * vol_factor);
+    fused_stream.setAudioInfo(audio_info);
+    fused_stream.setVolume(vol * vol_factor);
+    fused_stream.begin();
+    updateChain();
+
+    // open start alignment
+    playback.setAudioInfo(audio_info);
+    playback.begin();
 
     // open final output
-    out->setAudioInfo(audio_info);
+    checkOutputRate();
+    out->setAudioInfo(outputInfo());
     out->begin();
+    output_clock.setAudioInfo(outputInfo());
+    output_clock.begin();
 
     // open decoder
     auto dec_cfg = decoder_stream.defaultConfig();
@@ -229,24 +550,162 @@ class SnapOutput : public AudioInfoSupport {
 
     // open resampler
     auto res_cfg = resample.defaultConfig();
-    res_cfg.step_size = p_snap_time_sync->getFactor();
+    res_cfg.step_size = p_snap_time_sync->clockFactor();
     res_cfg.copyFrom(audio_info);
     resample.begin(res_cfg);
+    polyphase.setAudioInfo(audio_info);
+    polyphase.setOutputRate(output_rate);
+    polyphase.begin();
+    setPlaybackFactor(res_cfg.step_size);
 
     ESP_LOGD(TAG, "end");
     is_audio_begin_called = true;
     return true;
   }
 
-  /// to speed up or slow down playback
-  void setPlaybackFactor(float fact) { resample.setStepSize(fact); }
+  /// to speed up or slow down playback: small corrections are done w/o
+  /// resampling if the soft sync is active and w/o any difference we bypass
+  /// the resampler
+  void setPlaybackFactor(float fact) {
+    playback_factor = fact;
+    float ppm = (fact - 1.0f) * 1000000.0f;
+    float abs_ppm = fabs(ppm);
+    // hysteresis to avoid switching back and forth at the limit
+    float soft_limit = is_resampling ? 0.8f * soft_sync_max_ppm
+                                     : soft_sync_max_ppm;
+    // with a rate conversion the resampler also corrects the drift
+    if (!isRateConversion() && (abs_ppm < 1.0f || abs_ppm <= soft_limit)) {
+      playback.setCorrection(abs_ppm < 1.0f ? 0.0f : ppm);
+      setResampling(false);
+    } else {
+      playback.setCorrection(0.0f);
+      resample.setStepSize(fact);
+      polyphase.setStepSize(fact);
+      fused_stream.setStepSize(usePolyphase() ? 1.0f : fact);
+      setResampling(true);
+    }
+  }
 
   /// determine actual playback speed
-  float playbackFactor() { return resample.getStepSize(); }
+  float playbackFactor() { return playback_factor; }
+
+  /// inserts or removes the resampler from the output chain
+  void setResampling(bool active) {
+    if (active == is_resampling || out == nullptr) return;
+    ESP_LOGI(TAG, "resampling: %s", active ? "on" : "off");
+    is_resampling = active;
+    if (!active) fused_stream.setStepSize(1.0f);
+    updateChain();
+  }
+
+  /// Returns true if the sample rate of the audio is converted to the
+  /// defined output sample rate: this is only supported for 16 bit audio
+  bool isRateConversion() {
+    return output_rate > 0 && output_rate != audio_info.sample_rate &&
+           audio_info.bits_per_sample == 16;
+  }
+
+  /// Reports an output sample rate which can not be applied
+  void checkOutputRate() {
+    if (output_rate > 0 && output_rate != audio_info.sample_rate &&
+        !isRateConversion()) {
+      ESP_LOGE(TAG, "No conversion to %d for %d bits: using %d", output_rate,
+               audio_info.bits_per_sample, audio_info.sample_rate);
+    }
+  }
+
+  /// the polyphase resampler supports 16 bit audio only
+  bool usePolyphase() {
+    return (is_polyphase || isRateConversion()) &&
+           audio_info.bits_per_sample == 16;
+  }
 
-  void audioWriteSilence() {
-    for (int j = 0; j < 50; j++) {
-      out->writeSilence(1024);
+  /// provides the actual delay to the sync and updates the playback speed
+  void updatePlaybackSpeed(int64_t delay_us) {
+    SnapTimeSync &ts = *p_snap_time_sync;
+    ts.updateActualDelay(delay_us);
+
+    if (ts.isSync()) {
+      // update speed
+      float current_factor = playbackFactor();
+      float new_factor = ts.getFactor();
+      if (new_factor != current_factor) {
+        setPlaybackFactor(new_factor);
+      }
+    }
+  }
+
+  /// converts a number of frames to us
+  int64_t toMicros(int64_t frames) {
+    if (audio_info.sample_rate <= 0) return 0;
+    return frames * 1000000 / audio_info.sample_rate;
+  }
+
+  /// server time in us at the end of the decoded audio (w/o concealment)
+  int64_t streamEndUs() {
+    return stream_base_us +
+           toMicros(playback.inputFrames() - stream_base_frames);
+  }
+
+  /// compares the timestamp of the chunk with the end of the decoded audio:
+  /// gaps are filled with silence and inserted concealment is removed again.
+  /// Returns the inserted (positive) or removed (negative) time in us
+  int64_t updateStreamPosition(SnapAudioHeader &header) {
+    int64_t chunk_us = p_snap_time->toMicros(header.sec, header.usec);
+    int64_t frames = 0;
+    bool is_gap = false;
+    if (has_stream_pos) {
+      int64_t gap_us = chunk_us - streamEndUs();
+      is_gap = gap_us > gap_min_ms * 1000 || gap_us < -gap_min_ms * 1000;
+      if (is_gap) {
+        ESP_LOGW(TAG, "timestamp gap: %d ms", (int)(gap_us / 1000));
+        gap_count++;
+      }
+      // big gaps are handled by the playout check
+      bool is_fill = gap_us <= (int64_t)gap_max_fill_ms * 1000 &&
+                     gap_us >= -(int64_t)max_start_trim_ms * 1000;
+      if (is_gap && is_fill) {
+        frames = gap_us >= 0 ? playback.toFrames(gap_us)
+                             : -(int64_t)playback.toFrames(-gap_us);
+      }
+      frames -= concealed_frames;
+      if (frames > 0) {
+        playback.addSilenceFrames(frames);
+      } else if (frames < 0) {
+        playback.trimFrames(-frames);
+      }
+    }
+    concealed_frames = 0;
+    if (!has_stream_pos || is_gap) {
+      stream_base_us = chunk_us;
+      stream_base_frames = playback.inputFrames();
+      has_stream_pos = true;
+    }
+    return toMicros(frames);
+  }
+
+  /// Returns true if audio with the indicated delay can not be used any more
+  bool isTooLate(int64_t delay_us) {
+    if (start_mode == SnapStartAligned || is_sync_started)
+      return delay_us < -(int64_t)max_start_trim_ms * 1000;
+    return delay_us < 0;
+  }
+
+  /// the playback stage writes either to the fused stage or to the volume
+  /// control which write to the selected resampler or directly to the output
+  void updateChain() {
+    bool is_poly = usePolyphase();
+    Print *resampler = &output_clock;
+    if (is_resampling) {
+      resampler = is_poly ? (Print *)&polyphase : (Print *)&resample;
+    }
+    if (isFusedStage()) {
+      // the fused stage does the linear resampling itself
+      fused_stream.setOutput(is_poly ? *resampler : output_clock);
+      playback.setOutput(fused_stream);
+    } else {
+      vol_stream.setStream(*resampler);
+      playback.setOutput(vol_stream);
     }
   }
 
@@ -257,9 +716,10 @@ class SnapOutput : public AudioInfoSupport {
   }
 
 
-  bool synchronizeOnStart(int delay_ms) {
+  bool synchronizeOnStart(int64_t delay_us) {
     bool result = true;
-    if (delay_ms < 0) {
+    int delay_ms = delay_us / 1000;
+    if (isTooLate(delay_us)) {
       // ignore the data and report it as processed
       ESP_LOGW(TAG, "audio data expired: delay %d", delay_ms);
       result = false;
@@ -267,7 +727,15 @@ class SnapOutput : public AudioInfoSupport {
       ESP_LOGW(TAG, "invalid delay: %d ms", delay_ms);
       result = false;
     } else {
-      // wait for the audio to become valid
+      if (start_mode == SnapStartAligned) {
+        // wait for the audio to become valid by playing silence or drop the
+        // part which is already late
+        if (delay_us >= 0) {
+          playback.addSilenceFrames(playback.toFrames(delay_us));
+        } else {
+          playback.trimFrames(playback.toFrames(-delay_us));
+        }
+      }
       ESP_LOGI(TAG, "starting after %d ms", delay_ms);
       assert(p_snap_time_sync!=nullptr);
       setPlaybackFactor(p_snap_time_sync->getFactor());
@@ -277,16 +745,25 @@ class SnapOutput : public AudioInfoSupport {
     return result;
   }
 
-  /// Calculate the delay in ms
-  int getDelayMs() {
-    assert(p_snap_time_sync!=nullptr);
-    auto msg_time = snap_time.toMillis(header.sec, header.usec);
-    auto server_time = snap_time.serverMillis();
-    // wait for the audio to become valid
-    int diff_ms = msg_time - server_time;
-    int delay_ms = diff_ms + p_snap_time_sync->getStartDelay();
-    return delay_ms;
+  /// Applies the restart requested by restartSync()
+  void updateRestart() {
+    uint32_t request = restart_request.load(std::memory_order_acquire);
+    if (request == restart_done) return;
+    restart_done = request;
+    resetSync(!is_restart_cold.exchange(false));
+  }
+
+  /// Restarts the synchronization with the next chunk
+  void resetSync(bool isWarm) {
+    is_sync_started = false;
+    is_warm_start = isWarm;
+    has_stream_pos = false;
+    p_pending_data = nullptr;
+    chunk_playout = SnapPlayoutDrop;
   }
+
+  /// Calculate the delay in ms
+  int getDelayMs() { return getDelayMs(header.sec, header.usec); }
 };
 
 }
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "AudioTools.h"
+#include "SnapLogger.h"
+#include "SnapTime.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Last stage of the output chain which counts the frames that are
+ * consumed by the AudioOutput. Because the output is blocking, this follows
+ * the sample clock of the DAC: the actual output rate is estimated with a
+ * least squares fit of the frames against the monotonic CPU time. As
+ * SnapTimebase it provides the local time measured with the sample clock, so
+ * that the sync strategies correct the drift between the server and the DAC
+ * directly. The clock model is updated by the output task and published as
+ * snapshot, because the local time is also requested by the network task.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapOutputClock : public AudioStream, public SnapTimebase {
+ public:
+  /// Defines the final output
+  void setOutput(Print &out) { p_out = &out; }
+
+  bool begin() override {
+    points.clear();
+    frames = 0;
+    remainder = 0;
+    last_write_us = 0;
+    return true;
+  }
+
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    size_t result = p_out->write(data, len);
+    countFrames(result);
+    return result;
+  }
+
+  int availableForWrite() override {
+    return p_out == nullptr ? 0 : p_out->availableForWrite();
+  }
+
+  /// Provides the local time in us measured with the output sample clock
+  int64_t localMicros() override {
+    return toLocalMicros(clock_base.get(), SnapTime::localMicros());
+  }
+
+  /// Provides the difference of the output sample clock to the CPU clock in
+  /// ppm: positive values mean that the DAC runs faster
+  float outputRatePPM() { return (clock_base.get().ratio - 1.0) * 1000000.0; }
+
+  /// Defines the difference to the CPU clock in ppm (e.g. restored after a
+  /// reboot) which is used until it can be measured: call it before the
+  /// output is started
+  void setOutputRatePPM(float ppm) {
+    updateClockBase(1.0 + ppm / 1000000.0, false);
+  }
+
+  /// Returns true if the output rate has been measured
+  bool isRateMeasured() { return clock_base.get().is_measured; }
+
+  /// Provides the estimated effective output sample rate
+  double outputRate() { return clock_base.get().ratio * info.sample_rate; }
+
+  /// Total number of frames written to the output
+  uint64_t frameCount() { return frames; }
+
+  /// Defines the interval in which the frame count is recorded and the max
+  /// number of points that are used for the fit
+  void setWindow(int intervalMs, int count) {
+    interval_us = (int64_t)intervalMs * 1000;
+    window = std::max(3, count);
+  }
+
+ protected:
+  struct FramePoint {
+    int64_t cpu_us;
+    uint64_t frames;
+  };
+  /// local time = local_us + (cpu time - cpu_us) * ratio
+  struct ClockBase {
+    int64_t cpu_us = 0;
+    int64_t local_us = 0;
+    double ratio = 1.0;
+    bool is_measured = false;
+  };
+  const char *TAG = "SnapOutputClock";
+  Print *p_out = nullptr;
+  Vector<FramePoint> points;
+  uint64_t frames = 0;
+  size_t remainder = 0;
+  int64_t last_write_us = 0;
+  int64_t interval_us = 1000000;
+  int64_t gap_us = 500000;
+  int64_t settle_us = 1000000;
+  int64_t start_us = 0;
+  int window = 60;
+  int min_points = 10;
+  SnapSnapshot<ClockBase> clock_base;
+
+  int64_t toLocalMicros(const ClockBase &base, int64_t cpuUs) {
+    return base.local_us + (int64_t)((cpuUs - base.cpu_us) * base.ratio);
+  }
+
+  /// publishes the new ratio: the local time stays continuous
+  void updateClockBase(double ratio, bool isMeasured) {
+    ClockBase base = clock_base.get();
+    int64_t now_us = SnapTime::localMicros();
+    base.local_us = toLocalMicros(base, now_us);
+    base.cpu_us = now_us;
+    base.ratio = ratio;
+    base.is_measured = base.is_measured || isMeasured;
+    clock_base.set(base);
+  }
+
+  void countFrames(size_t bytes) {
+    int frame_size = info.channels * info.bits_per_sample / 8;
+    if (frame_size <= 0 || info.sample_rate <= 0) return;
+    remainder += bytes;
+    frames += remainder / frame_size;
+    remainder = remainder % frame_size;
+
+    int64_t now_us = SnapTime::localMicros();
+    // after a pause the frame count does not follow the sample clock
+    if (now_us - last_write_us > gap_us) {
+      points.clear();
+      start_us = now_us;
+    }
+    last_write_us = now_us;
+    // the first writes only fill the buffers of the output
+    if (now_us - start_us < settle_us) return;
+    if (points.size() > 0 && now_us - points.back().cpu_us < interval_us)
+      return;
+    if (points.size() >= window) points.pop_front();
+    points.push_back(FramePoint{now_us, frames});
+    updateRatio();
+  }
+
+  /// least squares fit of the frames against the CPU time
+  void updateRatio() {
+    int n = points.size();
+    if (n < min_points) return;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int j = 0; j < n; j++) {
+      double x = points[j].cpu_us - points[0].cpu_us;
+      double y = points[j].frames - points[0].frames;
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (denominator == 0.0) return;
+    double rate = (n * sxy - sx * sy) / denominator * 1000000.0;
+    double new_ratio = rate / info.sample_rate;
+    // ignore implausible values e.g. while the output buffer is filled
+    if (new_ratio < 0.999 || new_ratio > 1.001) return;
+    updateClockBase(new_ratio, true);
+    ESP_LOGD(TAG, "output rate: %f (%f ppm)", outputRate(), outputRatePPM());
+  }
+};
+
+}  // namespace snap_arduino
@@ -0,0 +1,410 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "AudioTools.h"
+#include "SnapConfig.h"
+#include "SnapLogger.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Defines how the playback is started
+ */
+enum SnapStartMode {
+  /// the first valid chunk is played immediately
+  SnapStartImmediate,
+  /// the remaining delay is compensated by silence or by trimming the decoded
+  /// audio, so that the start is sample accurate
+  SnapStartAligned
+};
+
+/**
+ * @brief PCM stage between the decoder and the volume control which can
+ * insert silence frames or remove frames from the decoded audio, so that the
+ * playback can be aligned to the server time with the accuracy of a sample.
+ * Small clock differences can be corrected w/o resampling by dropping or
+ * duplicating single frames at low energy points (16 bit audio only).
+ * Inserted silence starts with a short fade out from the last frame and the
+ * following audio is faded in again, so that gaps and underruns do not click.
+ * Mute is applied to the stream with a gain ramp, so the output continues
+ * with silence at its own pace. Pending silence can be written in slices
+ * with writeSilenceSlice() before the next audio is written.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapPlaybackStream : public AudioStream {
+ public:
+  /// Defines the next stage of the output chain
+  void setOutput(Print &out) { p_out = &out; }
+
+  bool begin() override {
+    reset();
+    return true;
+  }
+
+  /// Removes the pending silence and trim requests
+  void reset() {
+    silence_frames = 0;
+    trim_bytes = 0;
+    correction_credit = 0.0f;
+    byte_pos = 0;
+    input_bytes = 0;
+    has_last_frame = false;
+    fade_in_frames = 0;
+  }
+
+  /// Defines the correction in ppm: with positive values we drop frames to
+  /// play faster, with negative values we duplicate frames to play slower
+  void setCorrection(float ppm) { correction_ppm = ppm; }
+
+  /// Provides the actual correction in ppm
+  float correction() { return correction_ppm; }
+
+  /// Number of frames which have been dropped (positive) or inserted
+  /// (negative) by the correction
+  int32_t correctedFrames() { return corrected_frames; }
+
+  /// Writes the indicated number of silent frames before the next audio: a
+  /// pending trim is reduced first
+  void addSilenceFrames(uint32_t frames) {
+    size_t bytes = (size_t)frames * frameSize();
+    size_t reduce = std::min(trim_bytes, bytes);
+    trim_bytes -= reduce;
+    silence_frames += (bytes - reduce) / frameSize();
+  }
+
+  /// Removes the indicated number of frames from the next audio: pending
+  /// silence is reduced first
+  void trimFrames(uint32_t frames) {
+    uint32_t reduce = std::min(silence_frames, frames);
+    silence_frames -= reduce;
+    trim_bytes += (size_t)(frames - reduce) * frameSize();
+  }
+
+  /// Writes the indicated number of concealment frames immediately (e.g. on
+  /// a buffer underrun): returns the number of written frames
+  uint32_t writeConcealment(uint32_t frames) {
+    if (p_out == nullptr) return 0;
+    silence_frames += frames;
+    writeSilence(silence_frames);
+    return frames;
+  }
+
+  /// Number of silent frames which are written before the next audio
+  uint32_t pendingSilenceFrames() { return silence_frames; }
+
+  /// Writes the next part of the pending silence: at most
+  /// CONFIG_SNAPCAST_SILENCE_SLICE_MS and not more than the output can take
+  /// w/o blocking. Returns true if there is still silence pending.
+  bool writeSilenceSlice() {
+    if (p_out == nullptr || silence_frames == 0) return false;
+    uint32_t frames = std::max((uint32_t)1,
+        toFrames((int64_t)CONFIG_SNAPCAST_SILENCE_SLICE_MS * 1000));
+    int available = availableForWrite();
+    if (available > 0) {
+      frames = std::min(frames,
+          std::max((uint32_t)1, (uint32_t)(available / frameSize())));
+    }
+    writeSilence(std::min(frames, silence_frames));
+    return silence_frames > 0;
+  }
+
+  /// Total number of frames which have been provided by the decoder
+  uint64_t inputFrames() { return input_bytes / frameSize(); }
+
+  /// Defines the length of the fade out before and the fade in after
+  /// inserted silence and of the mute ramp
+  void setFadeFrames(uint32_t frames) { fade_frames = frames; }
+
+  /// Mutes or unmutes the audio with a gain ramp
+  void setMute(bool mute) { is_mute = mute; }
+
+  /// Returns true if the audio is muted
+  bool isMute() { return is_mute; }
+
+  /// Converts a duration in us to the number of frames
+  uint32_t toFrames(int64_t us) {
+    if (us < 0) return 0;
+    return (us * info.sample_rate + 500000) / 1000000;
+  }
+
+  /// Number of bytes of one frame (all channels)
+  size_t frameSize() {
+    return std::max(1, info.channels * info.bits_per_sample / 8);
+  }
+
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    size_t result = len;
+    input_bytes += len;
+    if (trim_bytes > 0) {
+      size_t skip = std::min(trim_bytes, len);
+      trim_bytes -= skip;
+      byte_pos += skip;
+      data += skip;
+      len -= skip;
+    }
+    writeSilence(silence_frames);
+    if (len > 0 && fade_in_frames > 0) {
+      size_t faded = writeFadeIn(data, len);
+      data += faded;
+      len -= faded;
+    }
+    if (len > 0) writePCM(data, len);
+    return result;
+  }
+
+  int availableForWrite() override {
+    return p_out == nullptr ? 0 : p_out->availableForWrite();
+  }
+
+ protected:
+  const char *TAG = "SnapPlaybackStream";
+  Print *p_out = nullptr;
+  uint32_t silence_frames = 0;
+  size_t trim_bytes = 0;
+  float correction_ppm = 0.0f;
+  float correction_credit = 0.0f;
+  int32_t corrected_frames = 0;
+  size_t byte_pos = 0;
+  uint64_t input_bytes = 0;
+  uint32_t fade_frames = CONFIG_SNAPCAST_FADE_FRAMES;
+  uint32_t fade_in_frames = 0;
+  static const int max_channels = 8;
+  int16_t last_frame[max_channels] = {0};
+  bool has_last_frame = false;
+  bool is_mute = false;
+  float mute_gain = 1.0f;
+
+  /// applies the mute if necessary
+  void writePCM(const uint8_t *data, size_t len) {
+    if (!is_mute && mute_gain == 1.0f) {
+      writeFrames(data, len);
+    } else {
+      writeMuted(data, len);
+    }
+  }
+
+  /// applies the soft sync correction
+  void writeFrames(const uint8_t *data, size_t len) {
+    keepLastFrame(data, len);
+    if (correction_ppm != 0.0f && info.bits_per_sample == 16) {
+      writeCorrected(data, len);
+      return;
+    }
+    byte_pos += len;
+    writeOut(data, len);
+  }
+
+  /// ramps the gain to the mute target: w/o 16 bit audio we just switch
+  void writeMuted(const uint8_t *data, size_t len) {
+    int16_t tmp[256];
+    size_t frame_size = frameSize();
+    bool is_ramp = isFadeSupported() && byte_pos % frame_size == 0;
+    while (len > 0) {
+      size_t n = std::min(len, sizeof(tmp));
+      if (is_ramp && n >= frame_size) {
+        n = n / frame_size * frame_size;
+        memcpy(tmp, data, n);
+        rampFrames(tmp, n / frame_size);
+      } else {
+        mute_gain = is_mute ? 0.0f : 1.0f;
+        if (is_mute) {
+          memset(tmp, 0, n);
+        } else {
+          memcpy(tmp, data, n);
+        }
+      }
+      writeFrames((const uint8_t *)tmp, n);
+      data += n;
+      len -= n;
+    }
+  }
+
+  /// applies the gain which moves by one step per frame to the target
+  void rampFrames(int16_t *samples, size_t frames) {
+    float target = is_mute ? 0.0f : 1.0f;
+    if (mute_gain == 0.0f && is_mute) {
+      memset(samples, 0, frames * frameSize());
+      return;
+    }
+    float step = 1.0f / fade_frames;
+    int channels = info.channels;
+    for (size_t j = 0; j < frames; j++) {
+      if (mute_gain < target) {
+        mute_gain = std::min(target, mute_gain + step);
+      } else if (mute_gain > target) {
+        mute_gain = std::max(target, mute_gain - step);
+      }
+      for (int ch = 0; ch < channels; ch++) {
+        samples[j * channels + ch] *= mute_gain;
+      }
+    }
+  }
+
+  /// we can only fade 16 bit audio
+  bool isFadeSupported() {
+    return info.bits_per_sample == 16 && info.channels > 0 &&
+           info.channels <= max_channels && fade_frames > 0;
+  }
+
+  /// records the last frame of the audio, which is the start of the fade out
+  void keepLastFrame(const uint8_t *data, size_t len) {
+    size_t frame_size = frameSize();
+    if (!isFadeSupported() || len < frame_size ||
+        (byte_pos + len) % frame_size != 0)
+      return;
+    memcpy(last_frame, data + len - frame_size, frame_size);
+    has_last_frame = true;
+  }
+
+  /// writes the beginning of the audio with increasing volume: returns the
+  /// number of processed bytes
+  size_t writeFadeIn(const uint8_t *data, size_t len) {
+    size_t frame_size = frameSize();
+    if (!isFadeSupported() || byte_pos % frame_size != 0) {
+      fade_in_frames = 0;
+      return 0;
+    }
+    int16_t tmp[128];
+    int channels = info.channels;
+    size_t max_frames = sizeof(tmp) / frame_size;
+    size_t frames = std::min((size_t)fade_in_frames, len / frame_size);
+    size_t done = 0;
+    while (done < frames) {
+      size_t n = std::min(max_frames, frames - done);
+      memcpy(tmp, data + done * frame_size, n * frame_size);
+      for (size_t j = 0; j < n; j++) {
+        uint32_t pos = fade_frames - fade_in_frames + done + j;
+        float factor = (float)(pos + 1) / fade_frames;
+        for (int ch = 0; ch < channels; ch++) {
+          tmp[j * channels + ch] *= factor;
+        }
+      }
+      writePCM((const uint8_t *)tmp, n * frame_size);
+      done += n;
+    }
+    fade_in_frames -= frames;
+    return frames * frame_size;
+  }
+
+  /// fades out from the last frame: returns the number of written frames
+  uint32_t writeFadeOut(uint32_t frames) {
+    if (!has_last_frame || !isFadeSupported()) return 0;
+    has_last_frame = false;
+    int16_t tmp[128];
+    int channels = info.channels;
+    size_t frame_size = frameSize();
+    size_t max_frames = sizeof(tmp) / frame_size;
+    uint32_t total = std::min(frames, fade_frames);
+    uint32_t done = 0;
+    while (done < total) {
+      size_t n = std::min(max_frames, (size_t)(total - done));
+      for (size_t j = 0; j < n; j++) {
+        float factor = 1.0f - (float)(done + j + 1) / fade_frames;
+        for (int ch = 0; ch < channels; ch++) {
+          tmp[j * channels + ch] = last_frame[ch] * factor;
+        }
+      }
+      writeOut((const uint8_t *)tmp, n * frame_size);
+      done += n;
+    }
+    return total;
+  }
+
+  /// drops or duplicates the frame with the lowest energy of the block when
+  /// the correction credit has reached a full frame
+  size_t writeCorrected(const uint8_t *data, size_t len) {
+    size_t frame_size = frameSize();
+    bool is_aligned = byte_pos % frame_size == 0;
+    byte_pos += len;
+    size_t frames = len / frame_size;
+    if (!is_aligned || frames < 2) return writeOut(data, len);
+
+    correction_credit += fabs(correction_ppm) * frames / 1000000.0f;
+    if (correction_credit < 1.0f) return writeOut(data, len);
+    correction_credit = std::min(correction_credit - 1.0f, 1.0f);
+
+    size_t idx = findQuietFrame((const int16_t *)data, frames);
+    size_t pos = idx * frame_size;
+    if (correction_ppm > 0) {
+      // drop the frame
+      writeOut(data, pos);
+      writeOut(data + pos + frame_size, len - pos - frame_size);
+      corrected_frames++;
+    } else {
+      // duplicate the frame
+      writeOut(data, pos + frame_size);
+      writeOut(data + pos, len - pos);
+      corrected_frames--;
+    }
+    return len;
+  }
+
+  /// determines the frame with the smallest sum of the absolute sample values
+  size_t findQuietFrame(const int16_t *samples, size_t frames) {
+    int channels = info.channels;
+    size_t result = 0;
+    int32_t min_energy = INT32_MAX;
+    for (size_t j = 0; j < frames; j++) {
+      int32_t energy = 0;
+      for (int ch = 0; ch < channels; ch++) {
+        energy += abs(samples[j * channels + ch]);
+      }
+      if (energy < min_energy) {
+        min_energy = energy;
+        result = j;
+      }
+    }
+    return result;
+  }
+
+  /// writes the indicated number of the pending silence frames: the first
+  /// part fades out from the last frame
+  void writeSilence(uint32_t count) {
+    if (count == 0) return;
+    ESP_LOGD(TAG, "silence: %u of %u frames", (unsigned)count,
+             (unsigned)silence_frames);
+    uint32_t faded = writeFadeOut(count);
+    silence_frames -= faded;
+    count -= faded;
+    if (isFadeSupported()) fade_in_frames = fade_frames;
+    uint8_t zero[128] = {0};
+    size_t frame_size = frameSize();
+    size_t max_frames = std::max((size_t)1, sizeof(zero) / frame_size);
+    while (count > 0) {
+      size_t frames = std::min((size_t)count, max_frames);
+      // a frame might be bigger then our buffer
+      for (size_t pos = 0; pos < frames * frame_size; pos += sizeof(zero)) {
+        writeOut(zero, std::min(sizeof(zero), frames * frame_size - pos));
+      }
+      silence_frames -= frames;
+      count -= frames;
+    }
+  }
+
+  /// writes all data to the next stage
+  size_t writeOut(const uint8_t *data, size_t len) {
+    size_t written = 0;
+    int retry = 0;
+    while (written < len) {
+      size_t result = p_out->write(data + written, len - written);
+      written += result;
+      if (result == 0 && ++retry > 10) {
+        ESP_LOGW(TAG, "Could not write all data %zu -> %zu", len, written);
+        break;
+      }
+    }
+    return written;
+  }
+};
+
+}  // namespace snap_arduino
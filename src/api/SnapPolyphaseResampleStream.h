@@ -0,0 +1,333 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "AudioTools.h"
+#include "SnapConfig.h"
+#include "SnapLogger.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Quality presets of the polyphase resampler: the higher the quality
+ * the more taps and phases are used
+ */
+enum SnapResampleQuality {
+  /// 8 taps, 32 phases
+  SnapResampleLow = 0,
+  /// 16 taps, 64 phases
+  SnapResampleMedium = 1,
+  /// 32 taps, 128 phases
+  SnapResampleHigh = 2
+};
+
+/// constexpr math to calculate the filter coefficients at compile time
+namespace snap_fir {
+
+constexpr double pi = 3.14159265358979323846;
+
+constexpr double sin(double x) {
+  while (x > pi) x -= 2.0 * pi;
+  while (x < -pi) x += 2.0 * pi;
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 14; n++) {
+    term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double sqrt(double x) {
+  if (x <= 0.0) return 0.0;
+  double result = x > 1.0 ? x : 1.0;
+  for (int j = 0; j < 40; j++) result = 0.5 * (result + x / result);
+  return result;
+}
+
+constexpr double sinc(double x) {
+  return x == 0.0 ? 1.0 : sin(pi * x) / (pi * x);
+}
+
+/// modified Bessel function of the first kind and order 0
+constexpr double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 40; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/// Kaiser window for x in the range of -1 to 1
+constexpr double kaiser(double x, double beta) {
+  if (x < -1.0 || x > 1.0) return 0.0;
+  return besselI0(beta * sqrt(1.0 - x * x)) / besselI0(beta);
+}
+
+}  // namespace snap_fir
+
+/**
+ * @brief Coefficients of a Kaiser windowed sinc low pass filter which are
+ * calculated at compile time. Row p contains the taps for the fractional
+ * position p / PHASES: the additional last row allows to interpolate between
+ * the phases. The cutoff is relative to the Nyquist frequency of the input.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+template <int TAPS, int PHASES>
+struct SnapFIRTable {
+  static constexpr int taps = TAPS;
+  static constexpr int phases = PHASES;
+  float coef[PHASES + 1][TAPS] = {};
+
+  constexpr SnapFIRTable(double cutoff, double beta) {
+    for (int p = 0; p <= PHASES; p++) {
+      double frac = (double)p / PHASES;
+      double row[TAPS] = {};
+      double sum = 0.0;
+      for (int i = 0; i < TAPS; i++) {
+        double distance = i - (TAPS / 2 - 1) - frac;
+        row[i] = cutoff * snap_fir::sinc(cutoff * distance) *
+                 snap_fir::kaiser(distance / (TAPS / 2), beta);
+        sum += row[i];
+      }
+      // unity gain for each phase
+      for (int i = 0; i < TAPS; i++) coef[p][i] = row[i] / sum;
+    }
+  }
+};
+
+/**
+ * @brief Polyphase FIR resampler for interleaved 16 bit audio which converts
+ * the sample rate (e.g. 44100 <-> 48000) and corrects the clock drift in a
+ * single stage. The filter tables are generated at compile time for the
+ * quality presets, so they end up in flash. The cutoff of 0.9 of the input
+ * Nyquist frequency is suitable for upsampling and for downsampling by up
+ * to 10%.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapPolyphaseResampleStream : public AudioStream {
+ public:
+  /// Defines the next stage of the output chain
+  void setOutput(Print &out) { p_out = &out; }
+
+  bool begin() override {
+    int channels = info.channels;
+    if (info.bits_per_sample != 16 || channels <= 0 ||
+        channels > max_channels) {
+      ESP_LOGE(TAG, "unsupported format: %d bits, %d channels",
+               info.bits_per_sample, channels);
+      is_active = false;
+      return false;
+    }
+    // the history starts with silence, so the first frame is at the center
+    int history = max_history;
+    buffer.resize(std::max(1024, (history + 256) * channels * 2));
+    memset(buffer.data(), 0, history * frameSize());
+    buffer_len = history * frameSize();
+    pos = history;
+    updateStep();
+    is_active = true;
+    return true;
+  }
+
+  /// Selects the filter preset: this can also be changed while the stream
+  /// is active because the history is kept for the biggest preset
+  void setQuality(SnapResampleQuality quality) { this->quality = quality; }
+
+  /// Provides the selected filter preset
+  SnapResampleQuality getQuality() { return quality; }
+
+  /// Defines the sample rate of the output: 0 to use the input rate
+  void setOutputRate(int rate) {
+    output_rate = rate;
+    updateStep();
+  }
+
+  /// Provides the sample rate of the output
+  int outputRate() { return output_rate > 0 ? output_rate : info.sample_rate; }
+
+  /// Defines the drift correction: > 1 to play faster, < 1 to play slower
+  void setStepSize(float step) {
+    step_size = step;
+    updateStep();
+  }
+
+  /// Provides the drift correction
+  float getStepSize() { return step_size; }
+
+  void setAudioInfo(AudioInfo info) override {
+    AudioStream::setAudioInfo(info);
+    updateStep();
+  }
+
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    if (!is_active) return p_out->write(data, len);
+    size_t result = len;
+    while (len > 0) {
+      // keep the room for at least one frame
+      if (buffer.size() - buffer_len < frameSize()) {
+        buffer.resize(buffer.size() * 2);
+      }
+      size_t n = std::min(len, buffer.size() - buffer_len);
+      memcpy(buffer.data() + buffer_len, data, n);
+      buffer_len += n;
+      data += n;
+      len -= n;
+      process();
+    }
+    return result;
+  }
+
+  int availableForWrite() override {
+    return p_out == nullptr ? 0 : p_out->availableForWrite();
+  }
+
+ protected:
+  static const int max_channels = 8;
+  static const int out_frames = 128;
+  // frames before the actual position which are needed by the biggest preset
+  static const int max_history = 32 / 2 - 1;
+  const char *TAG = "SnapPolyphaseResampleStream";
+  Print *p_out = nullptr;
+  SnapResampleQuality quality =
+      (SnapResampleQuality)CONFIG_SNAPCAST_RESAMPLE_QUALITY;
+  int output_rate = 0;
+  float step_size = 1.0f;
+  // input frames per output frame
+  double step = 1.0;
+  // position of the next output frame in the buffer
+  double pos = 0.0;
+  Vector<uint8_t> buffer;
+  size_t buffer_len = 0;
+  bool is_active = false;
+  int16_t out[out_frames * max_channels];
+
+  static const SnapFIRTable<8, 32> &lowTable() {
+    static constexpr SnapFIRTable<8, 32> table{0.85, 5.0};
+    return table;
+  }
+
+  static const SnapFIRTable<16, 64> &mediumTable() {
+    static constexpr SnapFIRTable<16, 64> table{0.9, 7.0};
+    return table;
+  }
+
+  static const SnapFIRTable<32, 128> &highTable() {
+    static constexpr SnapFIRTable<32, 128> table{0.9, 9.0};
+    return table;
+  }
+
+  size_t frameSize() { return info.channels * sizeof(int16_t); }
+
+  void updateStep() {
+    if (info.sample_rate <= 0) return;
+    step = (double)info.sample_rate / outputRate() * step_size;
+  }
+
+  void process() {
+    switch (quality) {
+      case SnapResampleLow:
+        process(lowTable());
+        break;
+      case SnapResampleMedium:
+        process(mediumTable());
+        break;
+      default:
+        process(highTable());
+        break;
+    }
+  }
+
+  /// determines all output frames for which we have the necessary input and
+  /// removes the input which is not needed any more
+  template <int TAPS, int PHASES>
+  void process(const SnapFIRTable<TAPS, PHASES> &table) {
+    static_assert(TAPS / 2 - 1 <= max_history, "history too small");
+    const int channels = info.channels;
+    const int16_t *in = (const int16_t *)buffer.data();
+    size_t frames = buffer_len / frameSize();
+    size_t out_count = 0;
+    float coef[TAPS];
+    while ((size_t)pos + TAPS / 2 < frames) {
+      size_t idx = (size_t)pos;
+      // interpolate the coefficients between the two nearest phases
+      float phase = (pos - idx) * PHASES;
+      int p = (int)phase;
+      float w = phase - p;
+      const float *c0 = table.coef[p];
+      const float *c1 = table.coef[p + 1];
+      for (int i = 0; i < TAPS; i++) coef[i] = c0[i] + w * (c1[i] - c0[i]);
+
+      const int16_t *x = in + (idx - (TAPS / 2 - 1)) * channels;
+      int16_t *result = out + out_count * channels;
+      if (channels == 2) {
+        float left = 0.0f;
+        float right = 0.0f;
+        for (int i = 0; i < TAPS; i++) {
+          left += coef[i] * x[2 * i];
+          right += coef[i] * x[2 * i + 1];
+        }
+        result[0] = clip(left);
+        result[1] = clip(right);
+      } else {
+        for (int ch = 0; ch < channels; ch++) {
+          float sum = 0.0f;
+          for (int i = 0; i < TAPS; i++) sum += coef[i] * x[i * channels + ch];
+          result[ch] = clip(sum);
+        }
+      }
+      pos += step;
+      if (++out_count == out_frames) {
+        writeOut(out, out_count * channels);
+        out_count = 0;
+      }
+    }
+    writeOut(out, out_count * channels);
+
+    // keep the history which is needed for the next output frame
+    size_t keep_from = std::min((size_t)pos, frames);
+    if (keep_from > max_history) {
+      size_t first = keep_from - max_history;
+      size_t bytes = first * frameSize();
+      memmove(buffer.data(), buffer.data() + bytes, buffer_len - bytes);
+      buffer_len -= bytes;
+      pos -= first;
+    }
+  }
+
+  static inline int16_t clip(float value) {
+    value += value >= 0.0f ? 0.5f : -0.5f;
+    value = std::min(32767.0f, std::max(-32768.0f, value));
+    return (int16_t)value;
+  }
+
+  /// writes all samples to the next stage
+  void writeOut(const int16_t *samples, size_t count) {
+    const uint8_t *data = (const uint8_t *)samples;
+    size_t len = count * sizeof(int16_t);
+    size_t written = 0;
+    int retry = 0;
+    while (written < len) {
+      size_t result = p_out->write(data + written, len - written);
+      written += result;
+      if (result == 0 && ++retry > 10) {
+        ESP_LOGW(TAG, "Could not write all data %zu -> %zu", len, written);
+        break;
+      }
+    }
+  }
+};
+
+}  // namespace snap_arduino
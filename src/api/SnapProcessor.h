@@ -1,12 +1,15 @@
 #pragma once
 
+#include "SnapClockStore.h"
 #include "SnapCommon.h"
 #include "SnapConfig.h"
 #include "SnapLogger.h"
 #include "SnapOutput.h"
 #include "SnapProcessor.h"
 #include "SnapProtocol.h"
+#include "SnapReceiveBuffer.h"
 #include "SnapTime.h"
+#include "SnapTimeScheduler.h"
 #include "vector"
 
 namespace snap_arduino {
@@ -46,12 +49,14 @@ public:
     }
 
     if (http_task_start) {
-      last_time_sync = 0;
       id_counter = 0;
       resizeData();
     }
     header_received = false;
     loop_status = LoopStart;
+    resetParser();
+    setupTimeMessageFrame();
+    loadClockState();
 
     return result;
   }
@@ -62,7 +67,7 @@ public:
     // ESP_LOGI(TAG, "... done reading from socket");
     p_client->stop();
     send_receive_buffer.resize(0);
-    base_message_serialized.resize(0);
+    receive_buffer.resize(0);
   }
 
   void setServerIP(IPAddress address) { server_ip = address; }
@@ -114,6 +119,13 @@ public:
     p_snap_output->setAudioInfo(info);
   }
 
+  /// Defines the storage for the clock model: it is restored in begin() and
+  /// saved every CONFIG_SNAPCAST_CLOCK_SAVE_SEC
+  void setClockStore(SnapClockStore &store) { p_clock_store = &store; }
+
+  /// Provides access to the scheduling of the time messages
+  SnapTimeScheduler &timeScheduler() { return time_scheduler; }
+
   // Select loop processing with minimum delays
   void setFastLoop(bool flag){
     is_fast_loop = flag;
@@ -137,6 +149,45 @@ public:
     return client_name;
   }
 
+  /// Defines the callback which is called for the stream tags (metadata)
+  void setStreamTagsCallback(void (*callback)(SnapMessageStreamTags &tags)) {
+    stream_tags_callback = callback;
+  }
+
+  /// Defines the max size of a message type: bigger messages are discarded.
+  /// All messages except the audio chunks also need to fit into the buffer of
+  /// CONFIG_SNAPCAST_BUFF_LEN bytes.
+  void setMaxMessageSize(MessageType type, uint32_t size) {
+    if (type > SNAPCAST_MESSAGE_LAST) return;
+    max_message_size[type] =
+        std::min(size, (uint32_t)CONFIG_SNAPCAST_MAX_VALID_MESSAGE_SIZE);
+  }
+
+  /// Provides the number of discarded messages
+  uint32_t discardedMessageCount() { return discarded_message_count; }
+
+  /// Provides the number of audio chunks which were dropped because they
+  /// exceeded the max wire chunk size
+  uint32_t oversizeChunkCount() { return oversize_chunk_count; }
+
+  /// Provides the number of expired audio chunks skipped before the playback
+  /// has started
+  uint32_t expiredChunkCount() { return expired_chunk_count; }
+
+  /// Provides the number of bytes which were skipped to find the next valid
+  /// message after a corrupted frame
+  uint32_t resyncSkippedBytes() { return resync_skipped_bytes; }
+
+  /// Provides the number of resynchronizations after corrupted frames
+  uint32_t resyncCount() { return resync_count; }
+
+  /// Defines the size of the receive buffer (call before begin): 0 reads the
+  /// messages directly from the client
+  void setReceiveBufferSize(size_t size) { receive_buffer_size = size; }
+
+  /// Provides the number of Client::read() calls in the last second
+  uint32_t readCallsPerSecond() { return read_calls_per_second; }
+
 protected:
   const char *TAG = "SnapProcessor";
   //  WiFiClient default_client;
@@ -144,7 +195,9 @@ protected:
   SnapOutput *p_snap_output = nullptr;
   std::vector<int16_t> audio;
   std::vector<char> send_receive_buffer;
-  std::vector<char> base_message_serialized;
+  // outbound frames: base message and body are written with one call
+  char send_buffer[BASE_MESSAGE_SIZE + MAX_JSON_LEN];
+  char time_message_frame[BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE];
   int16_t frame_size = 512;
   uint16_t channels = 2;
   codec_type codec_from_server = NO_CODEC;
@@ -155,7 +208,10 @@ protected:
   char *start = nullptr;
   int size = 0;
   timeval now;
-  uint64_t last_time_sync = 0;
+  SnapTimeScheduler time_scheduler;
+  SnapClockStore *p_clock_store = nullptr;
+  SnapClockState clock_state;
+  uint32_t clock_save_ms = 0;
   int id_counter = 0;
   IPAddress server_ip;
   int server_port = CONFIG_SNAPCAST_SERVER_PORT;
@@ -164,12 +220,48 @@ protected:
   bool http_task_start = true;
   bool header_received = false;
   bool is_time_set = false;
-  SnapTime &snap_time = SnapTime::instance();
   bool is_fast_loop = false;
   enum loop_status_enum { LoopStart, LoopStep, LoopEnd };
   loop_status_enum loop_status = LoopStart;
+  enum parse_status_enum { ParseHeader, ParsePayload, ParseDiscard };
+  parse_status_enum parse_status = ParseHeader;
+  uint32_t parse_pos = 0;  // bytes received of the current header or payload
+  uint32_t part_pos = 0;   // payload position of the audio in the buffer
   const char* hostname = CONFIG_SNAPCAST_CLIENT_NAME;
   const char* client_name = "libsnapcast";
+  void (*stream_tags_callback)(SnapMessageStreamTags &tags) = nullptr;
+  uint32_t max_message_size[SNAPCAST_MESSAGE_LAST + 1] = {
+      0,
+      CONFIG_SNAPCAST_MAX_CODEC_HEADER_SIZE,
+      CONFIG_SNAPCAST_MAX_WIRE_CHUNK_SIZE,
+      CONFIG_SNAPCAST_MAX_SERVER_SETTINGS_SIZE,
+      CONFIG_SNAPCAST_MAX_TIME_SIZE,
+      0,
+      CONFIG_SNAPCAST_MAX_STREAM_TAGS_SIZE};
+  uint32_t discarded_message_count = 0;
+  uint32_t oversize_chunk_count = 0;
+  uint32_t expired_chunk_count = 0;
+  // header of the wire chunk which is written next
+  SnapAudioHeader audio_header;
+  SnapReceiveBuffer receive_buffer;
+  size_t receive_buffer_size = CONFIG_SNAPCAST_RECEIVE_BUFFER_SIZE;
+  uint32_t read_call_count = 0;
+  uint64_t received_bytes = 0;
+  uint32_t read_calls_per_second = 0;
+  uint32_t read_call_count_time = 0;
+  uint32_t reconnect_delay_ms = 0;
+  uint32_t next_connect_ms = 0;
+  uint32_t codec_header_hash = 0;
+  bool is_clock_check = false;
+  bool is_resync = false;
+  bool has_last_message = false;
+  tv_t last_message_sent;
+  uint32_t resync_count = 0;
+  uint32_t resync_skipped_bytes = 0;
+  uint32_t resync_start_bytes = 0;
+
+  /// the time model of the output
+  SnapTime &snapTime() { return p_snap_output->snapTime(); }
 
   bool processLoopStepFast() {
     switch (loop_status) {
@@ -177,11 +269,12 @@ protected:
         if (connectClient()) {
           ESP_LOGI(TAG, "... connected");
         } else {
-          delay(10);
+          processExt();
           return false;
         }
 
-        now = snap_time.time();
+        now = snapTime().monotonicTime();
+        resetParser();
         if (!writeHallo()) {
           ESP_LOGI(TAG, "writeHallo");
           return false;
@@ -219,11 +312,12 @@ protected:
     if (connectClient()) {
       ESP_LOGI(TAG, "... connected");
     } else {
-      delay(10);
+      processExt();
       return false;
     }
 
-    now = snap_time.time();
+    now = snapTime().monotonicTime();
+    resetParser();
 
     if (!writeHallo()){
       ESP_LOGI(TAG, "writeHallo");
@@ -249,29 +343,95 @@ protected:
 
   /// additional processing
   virtual void processExt() {
+    concealUnderrun();
     // For rtos, give audio output some space
     delay(5);
   }
 
+  /// Fills the output with silence if no audio has been received in time
+  virtual void concealUnderrun() { p_snap_output->writeUnderrun(); }
+
   bool resizeData() {
     audio.resize(frame_size);
     send_receive_buffer.resize(CONFIG_SNAPCAST_BUFF_LEN);
-    base_message_serialized.resize(BASE_MESSAGE_SIZE);
+    receive_buffer.resize(receive_buffer_size);
     return true;
   }
 
+  /// Reads the available data and processes all complete messages: we never
+  /// wait for a complete message
   bool processMessageLoop() {
     ESP_LOGD(TAG, "processMessageLoop");
-    // Wait for data
-    if (p_client->available() < BASE_MESSAGE_SIZE) {
-      return true;
+    // a chunk which waits for the silence before it is kept in the buffer,
+    // so we do not process any further messages until it has been written
+    if (p_snap_output->writePending()) return writeTimedMessage();
+    fillReceiveBuffer();
+    bool is_processed = true;
+    bool is_any_processed = false;
+    while (is_processed && !p_snap_output->isWritePending()) {
+      if (!processNextMessage(is_processed))
+        return false;
+      is_any_processed = is_any_processed || is_processed;
     }
-
-    if (!readBaseMessage())
+    // time messages are sent independently of the received data
+    if (!writeTimedMessage())
+      return false;
+    // without data we check if the connection has been lost
+    if (!is_any_processed && receiveAvailable() <= 0 &&
+        !p_client->connected()) {
+      ESP_LOGW(TAG, "connection lost");
       return false;
+    }
+    return true;
+  }
+
+  /// Processes the next message with the data that is available: is_processed
+  /// is set to true when a message has been completed
+  bool processNextMessage(bool &is_processed) {
+    is_processed = false;
+    if (parse_status == ParseHeader) {
+      if (!readPartial(&send_receive_buffer[0], BASE_MESSAGE_SIZE))
+        return true;
+      if (!readBaseMessage())
+        return false;
+      if (!isValidBaseMessage()) {
+        // search the next message start by moving on by one byte
+        is_processed = true;
+        return resyncStep();
+      }
+      setReceiveTime();
+      if (is_resync) {
+        ESP_LOGW(TAG, "resynchronized: skipped %u bytes",
+                 (unsigned)(resync_skipped_bytes - resync_start_bytes));
+        is_resync = false;
+      }
+      parse_pos = 0;
+      last_message_sent = base_message.sent;
+      has_last_message = true;
+      parse_status = isMessageNeeded() ? ParsePayload : ParseDiscard;
+    }
+
+    // audio is passed on in parts of the buffer size
+    if (parse_status == ParsePayload &&
+        base_message.type == SNAPCAST_MESSAGE_WIRE_CHUNK) {
+      if (!readWireChunkHeader())
+        return true;
+      if (parse_status == ParsePayload)
+        return processWireChunkPart(is_processed);
+    }
+
+    if (parse_status == ParseDiscard) {
+      if (!discardData())
+        return true;
+      parse_status = ParseHeader;
+      is_processed = true;
+      return true;
+    }
 
     if (!readData())
-      return false;
+      return true;
+    parse_status = ParseHeader;
+    is_processed = true;
 
     switch (base_message.type) {
     case SNAPCAST_MESSAGE_CODEC_HEADER:
@@ -279,14 +439,6 @@ protected:
       header_received = true;
       break;
 
-    case SNAPCAST_MESSAGE_WIRE_CHUNK:
-      // chunk_cnt++;
-      if (!header_received) {
-        return true;
-      }
-      processMessageWireChunk();
-      break;
-
     case SNAPCAST_MESSAGE_SERVER_SETTINGS:
       processMessageServerSettings();
       break;
@@ -295,22 +447,306 @@ protected:
       processMessageTime();
       break;
 
+    case SNAPCAST_MESSAGE_STREAM_TAGS:
+      processMessageStreamTags();
+      break;
+
     default:
       ESP_LOGD(TAG, "Invalid Message: %u", base_message.type);
     }
 
-    // If it's been a second or longer since our last time message was
-    // sent, do so now
-    if (!writeTimedMessage())
+    return true;
+  }
+
+  /// Checks if we need to store the payload of the actual message
+  bool isMessageNeeded() {
+    uint16_t type = base_message.type;
+    if (type > SNAPCAST_MESSAGE_LAST) {
+      ESP_LOGD(TAG, "Invalid Message: %u", type);
       return false;
+    }
+    if (type == SNAPCAST_MESSAGE_STREAM_TAGS && stream_tags_callback == nullptr)
+      return false;
+    if (type == SNAPCAST_MESSAGE_WIRE_CHUNK &&
+        (!header_received || base_message.size < WIRE_CHUNK_HEADER_SIZE))
+      return false;
+    uint32_t max_size = maxMessageSize(type);
+    if (base_message.size > max_size) {
+      if (type == SNAPCAST_MESSAGE_WIRE_CHUNK) {
+        // we loose audio: report the first and then every 100th chunk
+        if (oversize_chunk_count++ % 100 == 0)
+          ESP_LOGE(TAG, "Audio chunk too big: %u > %u (%u dropped)",
+                   base_message.size, max_size,
+                   (unsigned)oversize_chunk_count);
+      } else if (max_size > 0) {
+        ESP_LOGW(TAG, "Message type %u too big: %u", type, base_message.size);
+      }
+      return false;
+    }
+    return true;
+  }
+
+  /// Max size of the indicated message type: except for the audio chunks
+  /// the message needs to fit into the buffer
+  uint32_t maxMessageSize(uint16_t type) {
+    uint32_t result = max_message_size[type];
+    uint32_t buffer_size = send_receive_buffer.size();
+    if (type != SNAPCAST_MESSAGE_WIRE_CHUNK) {
+      result = std::min(result, buffer_size);
+    } else if (codec_from_server == OPUS) {
+      // opus packets can not be split
+      result = std::min(result, buffer_size + WIRE_CHUNK_HEADER_SIZE);
+    }
+    return result;
+  }
+
+  /// Reads the timestamp and size of the audio chunk: expired audio is
+  /// skipped w/o reading it while we wait for the playback start. Returns
+  /// false until the header has been received.
+  bool readWireChunkHeader() {
+    if (part_pos > 0)
+      return true;
+    if (!readPartial(&send_receive_buffer[0], WIRE_CHUNK_HEADER_SIZE))
+      return false;
+    part_pos = WIRE_CHUNK_HEADER_SIZE;
+    const uint8_t *chunk = (const uint8_t *)&send_receive_buffer[0];
+    audio_header = SnapAudioHeader();
+    audio_header.sec = snapReadLE<int32_t>(chunk);
+    audio_header.usec = snapReadLE<int32_t>(chunk + 4);
+    uint32_t chunk_size = snapReadLE<uint32_t>(chunk + 8);
+    audio_header.codec = codec_from_server;
+    if (chunk_size != base_message.size - WIRE_CHUNK_HEADER_SIZE ||
+        codec_from_server == NO_CODEC) {
+      ESP_LOGI(TAG, "Invalid wire chunk: %u", (unsigned)chunk_size);
+      parse_status = ParseDiscard;
+    } else if (isWireChunkExpired()) {
+      expired_chunk_count++;
+      parse_status = ParseDiscard;
+    }
+    return true;
+  }
+
+  /// Checks the timestamp of the audio chunk while we wait for the playback
+  /// start
+  bool isWireChunkExpired() {
+    if (!p_snap_output->isStarted() || p_snap_output->isSyncStarted())
+      return false;
+    int32_t sec = audio_header.sec;
+    int32_t usec = audio_header.usec;
+    if (p_snap_output->isExpired(sec, usec)) {
+      ESP_LOGD(TAG, "audio data expired: delay %d",
+               p_snap_output->getDelayMs(sec, usec));
+      return true;
+    }
+    return false;
+  }
 
+  /// Collects the next part of the audio chunk in the buffer and passes it
+  /// on: is_processed is set to true when a part has been written
+  bool processWireChunkPart(bool &is_processed) {
+    uint32_t part_size = std::min((uint32_t)send_receive_buffer.size(),
+                                  base_message.size - part_pos);
+    if (!readPartial(&send_receive_buffer[0], part_size, part_pos))
+      return true;
+    audio_header.offset = part_pos - WIRE_CHUNK_HEADER_SIZE;
+    audio_header.size = part_size;
+    part_pos += part_size;
+    if (part_pos >= base_message.size) {
+      parse_status = ParseHeader;
+      parse_pos = 0;
+      part_pos = 0;
+    }
+    is_processed = true;
+    if (part_size == 0)
+      return true;
+    writeAudioInfo(audio_header);
+    size_t written =
+        writeAudio((const uint8_t *)&send_receive_buffer[0], part_size);
+    if (written != part_size) {
+      ESP_LOGW(TAG, "Error writing audio chunk: %zu -> %zu", (size_t)part_size,
+               written);
+    }
+    return true;
+  }
+
+  /// Removes the payload from the client w/o storing it: returns true when
+  /// the message has been consumed
+  bool discardData() {
+    char slice[CONFIG_SNAPCAST_DISCARD_SLICE];
+    while (parse_pos < base_message.size) {
+      int available = receiveAvailable();
+      if (available <= 0)
+        return false;
+      if (receive_buffer.size() > 0) {
+        parse_pos += receive_buffer.skip(base_message.size - parse_pos);
+        continue;
+      }
+      uint32_t to_read = std::min((uint32_t)available,
+                                  (uint32_t)CONFIG_SNAPCAST_DISCARD_SLICE);
+      to_read = std::min(to_read, base_message.size - parse_pos);
+      int read = readClient((uint8_t *)slice, to_read);
+      if (read <= 0)
+        return false;
+      parse_pos += read;
+    }
+    parse_pos = 0;
+    part_pos = 0;
+    discarded_message_count++;
+    return true;
+  }
+
+  /// Discards any partially received message (e.g. after a reconnect)
+  void resetParser() {
+    parse_status = ParseHeader;
+    parse_pos = 0;
+    part_pos = 0;
+    receive_buffer.reset();
+    received_bytes = 0;
+    is_resync = false;
+    has_last_message = false;
+  }
+
+  /// Checks if the header as received from the server looks like a valid
+  /// message
+  bool isValidBaseMessage() {
+    if (base_message.type <= SNAPCAST_MESSAGE_FIRST)
+      return false;
+    // unknown (e.g. newer) types are skipped by their size, but while we
+    // search the next message start we only accept the known types
+    if (base_message.type > SNAPCAST_MESSAGE_LAST && is_resync)
+      return false;
+    if (base_message.size > CONFIG_SNAPCAST_MAX_VALID_MESSAGE_SIZE)
+      return false;
+    if (base_message.sent.usec < 0 || base_message.sent.usec >= 1000000)
+      return false;
+    if (base_message.received.usec < 0 ||
+        base_message.received.usec >= 1000000)
+      return false;
+    // after an error we also expect the time to continue
+    if (is_resync && has_last_message) {
+      int32_t diff_sec = base_message.sent.sec - last_message_sent.sec;
+      if (diff_sec < -1 || diff_sec > CONFIG_SNAPCAST_RESYNC_MAX_TIME_JUMP_SEC)
+        return false;
+    }
     return true;
   }
 
-  /// connects to the server: returns true if we are connected
-  bool connectClient() {
+  /// Drops the first byte of the invalid header: returns false if we need
+  /// to give up and reconnect
+  bool resyncStep() {
+    if (!is_resync) {
+      ESP_LOGW(TAG, "Invalid message header: resynchronizing");
+      is_resync = true;
+      resync_count++;
+      resync_start_bytes = resync_skipped_bytes;
+    }
+    memmove(&send_receive_buffer[0], &send_receive_buffer[1],
+            BASE_MESSAGE_SIZE - 1);
+    parse_pos = BASE_MESSAGE_SIZE - 1;
+    resync_skipped_bytes++;
+    if (resync_skipped_bytes - resync_start_bytes >
+        CONFIG_SNAPCAST_RESYNC_MAX_BYTES) {
+      ESP_LOGE(TAG, "No valid message found: reconnecting");
+      p_client->stop();
+      return false;
+    }
+    return true;
+  }
+
+  /// Reads all available data with one call into the receive buffer
+  void fillReceiveBuffer() {
+    updateReadStatistics();
+    if (receive_buffer.size() == 0 || isDirectRead())
+      return;
+    size_t len = 0;
+    uint8_t *data = receive_buffer.writeBuffer(len);
+    if (len == 0)
+      return;
+    int available = p_client->available();
+    if (available <= 0)
+      return;
+    int read = readClient(data, std::min(len, (size_t)available));
+    if (read > 0)
+      receive_buffer.commitWrite(read);
+  }
+
+  /// The rest of a big payload is read directly into the send_receive_buffer
+  /// when the receive buffer is empty: this avoids the copy via the ring
+  bool isDirectRead() {
+    return receive_buffer.available() == 0 && parse_status == ParsePayload &&
+           base_message.size - parse_pos >= receive_buffer.size() / 4;
+  }
+
+  /// Number of bytes which can be processed w/o blocking
+  int receiveAvailable() {
+    if (receive_buffer.size() > 0 && !isDirectRead())
+      return receive_buffer.available();
+    return p_client->available();
+  }
+
+  /// Provides the received data either from the receive buffer or the client
+  int receiveBytes(uint8_t *data, size_t len) {
+    if (receive_buffer.size() > 0 && !isDirectRead())
+      return receive_buffer.read(data, len);
+    return readClient(data, len);
+  }
+
+  int readClient(uint8_t *data, size_t len) {
+    read_call_count++;
+    int result = p_client->read(data, len);
+    if (result > 0) received_bytes += result;
+    return result;
+  }
+
+  /// Position of the next byte to be parsed in the received data stream
+  uint64_t streamPos() {
+    if (receive_buffer.size() > 0)
+      return received_bytes - receive_buffer.available();
+    return received_bytes;
+  }
+
+  /// Provides the local monotonic receive time in us of the byte at the
+  /// indicated stream position if the client supports it
+  virtual bool receiveTime(uint64_t streamPos, int64_t &timeUs) {
+    return false;
+  }
+
+  /// determines the number of read calls per second
+  void updateReadStatistics() {
+    uint32_t time_ms = millis();
+    if (time_ms - read_call_count_time >= 1000) {
+      read_calls_per_second = read_call_count;
+      read_call_count = 0;
+      read_call_count_time = time_ms;
+      ESP_LOGD(TAG, "read calls per second: %u", read_calls_per_second);
+    }
+  }
+
+  /// Reads the available bytes without blocking: returns true when len bytes
+  /// of the current header or payload have been received. The data starts at
+  /// the indicated position of the payload.
+  bool readPartial(char *data, uint32_t len, uint32_t from = 0) {
+    uint32_t end = from + len;
+    if (parse_pos < end) {
+      int available = receiveAvailable();
+      if (available <= 0)
+        return false;
+      uint32_t to_read = std::min((uint32_t)available, end - parse_pos);
+      int read = receiveBytes((uint8_t *)data + parse_pos - from, to_read);
+      if (read > 0)
+        parse_pos += read;
+    }
+    return parse_pos >= end;
+  }
+
+  /// connects to the server: returns true if we are connected. We do not
+  /// wait after a failed attempt but just retry after the backoff delay.
+  virtual bool connectClient() {
     ESP_LOGD(TAG, "start");
     if (p_client->connected()) return true;
+    if (!isReconnectDue()) {
+      return false;
+    }
     p_client->stop(); // for Ethernet.h 
     p_client->setTimeout(CONFIG_CLIENT_TIMEOUT_SEC);
     if (p_client->connect(server_ip, server_port)<=0) {
@@ -319,21 +755,42 @@ protected:
             server_ip[2], server_ip[3], server_port);
 
       ESP_LOGE(TAG, "Socket connect to %s failed (errno = %d)", str_address, errno);
-      delay(4000);
+      scheduleReconnect();
       return false;
     }
+    reconnect_delay_ms = 0;
     return true;
   }
 
+  /// Returns false while we wait for the backoff delay
+  bool isReconnectDue() {
+    return reconnect_delay_ms == 0 ||
+           (int32_t)(millis() - next_connect_ms) >= 0;
+  }
+
+  /// Determines the time of the next connect with an exponential backoff:
+  /// the jitter of +-25% prevents that all clients reconnect at the same time
+  void scheduleReconnect() {
+    reconnect_delay_ms =
+        reconnect_delay_ms == 0
+            ? CONFIG_SNAPCAST_RECONNECT_MIN_MS
+            : std::min(reconnect_delay_ms * 2,
+                       (uint32_t)CONFIG_SNAPCAST_RECONNECT_MAX_MS);
+    uint32_t jitter = rand() % (reconnect_delay_ms / 2 + 1);
+    next_connect_ms = millis() + reconnect_delay_ms * 3 / 4 + jitter;
+    ESP_LOGI(TAG, "reconnect in %u ms", (unsigned)(next_connect_ms - millis()));
+  }
+
   bool writeHallo() {
     ESP_LOGD(TAG, "start");
     // setup base_message
-    base_message.type = SNAPCAST_MESSAGE_HELLO;
-    base_message.id = 0x0;
-    base_message.refersTo = 0x0;
-    base_message.sent =  {(int32_t)now.tv_sec, (int32_t)now.tv_usec};
-    base_message.received =  {0x0, 0x0};
-    base_message.size = 0x0;
+    SnapMessageBase hello_base;
+    hello_base.type = SNAPCAST_MESSAGE_HELLO;
+    hello_base.id = 0x0;
+    hello_base.refersTo = 0x0;
+    hello_base.sent =  {(int32_t)now.tv_sec, (int32_t)now.tv_usec};
+    hello_base.received =  {0x0, 0x0};
+    hello_base.size = 0x0;
 
     // setup hello_message
     SnapMessageHallo hello_message;
@@ -347,59 +804,69 @@ protected:
     hello_message.id = mac_address;
     hello_message.protocol_version = 2;
 
-    char *hello_message_serialized =
-        hello_message.serialize((size_t *)&(base_message.size));
+    size_t hello_size = 0;
+    char *hello_message_serialized = hello_message.serialize(&hello_size);
     if (hello_message_serialized == nullptr) {
       ESP_LOGE(TAG, "Failed to serialize hello message");
       return false;
     }
+    hello_base.size = hello_size;
 
-    int result =
-        base_message.serialize(&base_message_serialized[0], BASE_MESSAGE_SIZE);
+    int result = hello_base.serialize(send_buffer, BASE_MESSAGE_SIZE);
     if (result) {
       ESP_LOGE(TAG, "Failed to serialize base message");
       return false;
     }
+    memcpy(send_buffer + BASE_MESSAGE_SIZE, hello_message_serialized,
+           hello_size);
 
-    p_client->write((const uint8_t *)&base_message_serialized[0],
-                    BASE_MESSAGE_SIZE);
-    p_client->write((const uint8_t *)hello_message_serialized,
-                    base_message.size);
+    p_client->write((const uint8_t *)send_buffer,
+                    BASE_MESSAGE_SIZE + hello_size);
 
+    // start with a burst of time messages
+    time_scheduler.begin();
+    // the clock model is only kept if the server time is still consistent
+    is_clock_check = true;
     return true;
   }
 
+  /// Deserializes the base message from the received header bytes
   bool readBaseMessage() {
     ESP_LOGD(TAG, "%d", BASE_MESSAGE_SIZE);
+    now = snapTime().monotonicTime();
 
-    // Read Header Record with size
-    size = p_client->readBytes(&send_receive_buffer[0], BASE_MESSAGE_SIZE);
-    ESP_LOGD(TAG, "Bytes read: %d", size);
-
-    now = snap_time.time();
-
-    int result = base_message.deserialize(&send_receive_buffer[0], size);
+    int result =
+        base_message.deserialize(&send_receive_buffer[0], BASE_MESSAGE_SIZE);
     if (result) {
       ESP_LOGW(TAG, "Failed to read base message: %d", result);
       return false;
     }
+    return true;
+  }
 
+  /// Replaces the received time of the (validated) base message with the
+  /// local receive time
+  void setReceiveTime() {
     // ESP_LOGI(TAG,"Rx dif : %d %d", base_message.sent.sec,
     // base_message.sent.usec/1000);
+    // use the more precise receive time of the transport if available
+    int64_t time_us;
+    if (base_message.type == SNAPCAST_MESSAGE_TIME &&
+        receiveTime(streamPos() - 1, time_us)) {
+      now = snapTime().toTimeval(time_us);
+    }
     base_message.received.sec = now.tv_sec;
     base_message.received.usec = now.tv_usec;
-    return true;
   }
 
+  /// Collects the payload: returns true when the message is complete
   bool readData() {
     ESP_LOGD(TAG, "%d", base_message.size);
-    if (base_message.size > send_receive_buffer.size()) {
-      send_receive_buffer.resize(base_message.size);
-    }
+    if (!readPartial(&send_receive_buffer[0], base_message.size))
+      return false;
+    parse_pos = 0;
     start = &send_receive_buffer[0];
-    while (p_client->available() < base_message.size)
-      delay(10);
-    size = p_client->readBytes(&(send_receive_buffer[0]), base_message.size);
+    size = base_message.size;
     return true;
   }
 
@@ -415,40 +882,60 @@ protected:
 
     ESP_LOGI(TAG, "Received codec header message");
 
+    // after a reconnect we keep the decoder and output if nothing has changed
+    uint32_t hash = hashData(start, size);
+    if (hash == codec_header_hash && codec_from_server != NO_CODEC &&
+        p_snap_output->isStarted()) {
+      ESP_LOGI(TAG, "Codec header unchanged: resuming playback");
+      p_snap_output->restartSync();
+      return true;
+    }
+    codec_header_hash = hash;
+
     size = codec_header_message.size;
-    start = codec_header_message.payload();
-    if (strcmp(codec_header_message.codec(), "opus") == 0) {
+    start = codec_header_message.payload;
+    SnapView &codec = codec_header_message.codec;
+    if (codec.equals("opus")) {
       if (!processMessageCodecHeaderOpus(OPUS))
         return false;
-    } else if (strcmp(codec_header_message.codec(), "flac") == 0) {
+    } else if (codec.equals("flac")) {
       if (!processMessageCodecHeaderExt(FLAC))
         return false;
-    } else if (strcmp(codec_header_message.codec(), "ogg") == 0) {
+    } else if (codec.equals("ogg")) {
       if (!processMessageCodecHeaderExt(OGG))
         return false;
-    } else if (strcmp(codec_header_message.codec(), "pcm") == 0) {
+    } else if (codec.equals("pcm")) {
       if (!processMessageCodecHeaderWav(PCM))
         return false;
     } else {
-      ESP_LOGI(TAG, "Codec : %s not supported", codec_header_message.codec());
+      ESP_LOGI(TAG, "Codec : %.*s not supported", (int)codec.size, codec.data);
       ESP_LOGI(TAG, "Change encoder codec to opus in /etc/snapserver.conf on "
                     "server");
       return false;
     }
-    ESP_LOGI(TAG, "Codec : %s , Size: %d ", codec_header_message.codec(), size);
+    ESP_LOGI(TAG, "Codec : %.*s , Size: %d ", (int)codec.size, codec.data, size);
     // codec_header_message.release();
 
     return true;
   }
 
+  /// FNV-1a hash to detect changes
+  uint32_t hashData(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t j = 0; j < len; j++) {
+      hash = (hash ^ (uint8_t)data[j]) * 16777619u;
+    }
+    return hash;
+  }
+
   bool processMessageCodecHeaderOpus(codec_type codecType) {
     ESP_LOGD(TAG, "start");
-    uint32_t rate;
-    memcpy(&rate, start + 4, sizeof(rate));
-    uint16_t bits;
-    memcpy(&bits, start + 8, sizeof(bits));
-    memcpy(&channels, start + 10, sizeof(channels));
-    // notify output about format
+    const uint8_t *opus_header = (const uint8_t *)start;
+    uint32_t rate = snapReadLE<uint32_t>(opus_header + 4);
+    uint16_t bits = snapReadLE<uint16_t>(opus_header + 8);
+    channels = snapReadLE<uint16_t>(opus_header + 10);
+    // notify output about format: with a fixed output sample rate the
+    // SnapOutput converts the rate
     AudioInfo info(rate, channels, bits);
     setAudioInfo(info);
     audioBegin();
@@ -474,59 +961,9 @@ protected:
     return true;
   }
 
-  bool processMessageWireChunk() {
-    ESP_LOGD(TAG, "start");
-    start = &send_receive_buffer[0];
-    SnapMessageWireChunk wire_chunk_message;
-    memset((void*)&wire_chunk_message, 0, sizeof(wire_chunk_message));
-    int result = wire_chunk_message.deserialize(start, size);
-    if (result) {
-      ESP_LOGI(TAG, "Failed to read wire chunk: %d", result);
-      return false;
-    }
-    switch (codec_from_server) {
-    case FLAC:
-    case OGG:
-    case OPUS:
-    case PCM:
-      wireChunk(wire_chunk_message);
-      break;
-    case NO_CODEC:
-      ESP_LOGE(TAG, "Invalid codec");
-      break;
-    }
-    // wire_chunk_message_free(&wire_chunk_message);
-    return true;
-  }
-
-  bool wireChunk(SnapMessageWireChunk &wire_chunk_message) {
-    ESP_LOGD(TAG, "start");
-    SnapAudioHeader header;
-    header.size = wire_chunk_message.size;
-    
-    header.sec = wire_chunk_message.timestamp.sec;
-    header.usec = wire_chunk_message.timestamp.usec;
-    header.codec = codec_from_server;
-    writeAudioInfo(header);
-
-    size_t chunk_res;
-    if ((chunk_res = writeAudio((const uint8_t *)wire_chunk_message.payload,
-                                wire_chunk_message.size)) !=
-        wire_chunk_message.size) {
-      ESP_LOGW(TAG, "Error writing audio chunk: %zu -> %zu",(size_t)wire_chunk_message.size, chunk_res);
-    }
-    return true;
-  }
-
   bool processMessageServerSettings() {
     ESP_LOGD(TAG, "start");
-    // The first 4 bytes in the buffer are the size of the string.
-    // We don't need this, so we'll shift the entire buffer over 4 bytes
-    // and use the extra room to add a null character so we can pares
-    // it.
-    memmove(start, start + 4, size - 4);
-    start[size - 3] = '\0';
-    int result = server_settings_message.deserialize(start);
+    int result = server_settings_message.deserialize(start, size);
     if (result) {
       ESP_LOGI(TAG, "Failed to read server settings: %d", result);
       return false;
@@ -553,6 +990,19 @@ protected:
     return true;
   }
 
+  bool processMessageStreamTags() {
+    ESP_LOGD(TAG, "start");
+    if (stream_tags_callback == nullptr) return true;
+    SnapMessageStreamTags stream_tags_message;
+    int result = stream_tags_message.deserialize(start, size);
+    if (result) {
+      ESP_LOGI(TAG, "Failed to read stream tags: %d", result);
+      return false;
+    }
+    stream_tags_callback(stream_tags_message);
+    return true;
+  }
+
   bool processMessageTime() {
     ESP_LOGD(TAG, "start");
     int result = time_message.deserialize(start, size);
@@ -561,32 +1011,86 @@ protected:
       return false;
     }
 
-    // // Calculate TClienctx.tdif : Trx-Tsend-Tnetdelay/2
-    struct timeval ttx, trx;
-    ttx.tv_sec = base_message.sent.sec;
-    ttx.tv_usec = base_message.sent.usec;
-    trx.tv_sec = base_message.received.sec;
-    trx.tv_usec = base_message.received.usec;
+    // four timestamps: the server provides c2s in the latency and we measure
+    // s2c, both contain the clock offset with opposite signs
+    int64_t c2s_us = toUs(time_message.latency);
+    int64_t s2c_us = toUs(base_message.received) - toUs(base_message.sent);
+    if (is_clock_check) {
+      is_clock_check = false;
+      checkClockModel(c2s_us, s2c_us);
+    }
+    int32_t rtt_us = snapTime().addTimeSample(c2s_us, s2c_us);
+    time_scheduler.addSample(rtt_us, snapTime().timeDifferenceErrorUs());
+
+    // for synchronization: server time at reception w/o the network delay
+    // which is paired with the (kernel) receive time
+    int64_t server_us = toUs(base_message.sent) + rtt_us / 2;
+    p_snap_output->snapTimeSync().updateServerTime(
+        server_us, toUs(base_message.received));
+    saveClockState();
+
+    ESP_LOGD(TAG, "Time Difference to Server: %d ms (+-%d us) rtt: %d us",
+             snapTime().timeDifferenceClientServerMs(),
+             (int)snapTime().timeDifferenceErrorUs(), (int)rtt_us);
+    return true;
+  }
 
-    // for time management
-    snap_time.updateServerTime(trx);
-    // for synchronization
-    p_snap_output->snapTimeSync().updateServerTime(snap_time.toMillis(trx));
+  /// Discards the clock model of the last connection if the first time
+  /// message after a reconnect does not agree with it (e.g. because the
+  /// server has been restarted)
+  void checkClockModel(int64_t c2sUs, int64_t s2cUs) {
+    if (snapTime().isConsistent(c2sUs, s2cUs)) return;
+    ESP_LOGW(TAG, "Server time changed: resetting the clock model");
+    snapTime().resetTimeSamples();
+    if (p_snap_output->hasSnapTimeSync())
+      p_snap_output->snapTimeSync().resetTimePoints();
+    p_snap_output->restartSync(false);
+  }
 
-    int64_t time_diff = snap_time.timeDifferenceMs(trx, ttx);
-    uint32_t time_diff_int = time_diff;
-    assert(time_diff_int == time_diff);
-    ESP_LOGD(TAG, "Time Difference to Server: %ld ms", time_diff);
-    snap_time.setTimeDifferenceClientServerMs(time_diff);
+  /// restores the persisted clock model
+  void loadClockState() {
+    clock_save_ms = millis();
+    if (p_clock_store == nullptr || !p_snap_output->hasSnapTimeSync()) return;
+    if (!p_clock_store->load(clock_state)) {
+      ESP_LOGI(TAG, "no clock state");
+      return;
+    }
+    ESP_LOGI(TAG, "restored drift: %f ppm, output: %f ppm",
+             clock_state.drift_ppm, clock_state.output_ppm);
+    p_snap_output->snapTimeSync().setDriftPPM(clock_state.drift_ppm);
+    p_snap_output->outputClock().setOutputRatePPM(clock_state.output_ppm);
+  }
 
-    return true;
+  /// persists the measured clock model periodically if it has changed
+  void saveClockState() {
+    if (p_clock_store == nullptr) return;
+    if (millis() - clock_save_ms < CONFIG_SNAPCAST_CLOCK_SAVE_SEC * 1000)
+      return;
+    clock_save_ms = millis();
+    SnapTimeSync &ts = p_snap_output->snapTimeSync();
+    if (!ts.isDriftMeasured()) return;
+    SnapClockState state = clock_state;
+    state.drift_ppm = ts.driftPPM();
+    SnapOutputClock &clock = p_snap_output->outputClock();
+    if (clock.isRateMeasured()) state.output_ppm = clock.outputRatePPM();
+    // avoid unnecessary flash writes
+    if (fabs(state.drift_ppm - clock_state.drift_ppm) < 0.5f &&
+        fabs(state.output_ppm - clock_state.output_ppm) < 0.5f)
+      return;
+    if (p_clock_store->save(state)) {
+      clock_state = state;
+      ESP_LOGI(TAG, "saved drift: %f ppm", state.drift_ppm);
+    }
+  }
+
+  inline int64_t toUs(const tv_t &tv) {
+    return (int64_t)tv.sec * 1000000 + tv.usec;
   }
 
   bool writeTimedMessage() {
     ESP_LOGD(TAG, "start");
-    uint32_t time_ms = millis() - last_time_sync;
-    if (time_ms >= 1000) {
-      last_time_sync = millis();
+    if (time_scheduler.isDue()) {
+      time_scheduler.setSent();
       if (!writeMessage()) {
         return false;
       }
@@ -594,37 +1098,34 @@ protected:
     return true;
   }
 
+  /// Serializes the time request: only the id and the sent time change
+  void setupTimeMessageFrame() {
+    SnapMessageBase time_base;
+    time_base.type = SNAPCAST_MESSAGE_TIME;
+    time_base.id = 0;
+    time_base.refersTo = 0;
+    time_base.sent = {0, 0};
+    time_base.received = {0, 0};
+    time_base.size = TIME_MESSAGE_SIZE;
+    time_base.serialize(time_message_frame, BASE_MESSAGE_SIZE);
+
+    SnapMessageTime time_request;
+    time_request.latency = {0, 0};
+    time_request.serialize(time_message_frame + BASE_MESSAGE_SIZE,
+                           TIME_MESSAGE_SIZE);
+  }
+
   bool writeMessage() {
     ESP_LOGD(TAG, "start");
 
-    now = snap_time.time();
+    now = snapTime().monotonicTime();
 
-    base_message.type = SNAPCAST_MESSAGE_TIME;
-    base_message.id = id_counter++;
-    base_message.refersTo = 0;
-    base_message.received.sec = 0;
-    base_message.received.usec = 0;
-    base_message.sent.sec = now.tv_sec;
-    base_message.sent.usec = now.tv_usec;
-    base_message.size = TIME_MESSAGE_SIZE;
+    uint8_t *frame = (uint8_t *)time_message_frame;
+    snapWriteLE<uint16_t>(frame + SnapMessageBase::ID_POS, id_counter++);
+    snapWriteLE<int32_t>(frame + SnapMessageBase::SENT_POS, now.tv_sec);
+    snapWriteLE<int32_t>(frame + SnapMessageBase::SENT_POS + 4, now.tv_usec);
 
-    int result =
-        base_message.serialize(&base_message_serialized[0], BASE_MESSAGE_SIZE);
-    if (result) {
-      ESP_LOGE(TAG, "Failed to serialize base message for time");
-      return true;
-    }
-
-    result = time_message.serialize(&send_receive_buffer[0],
-                                    CONFIG_SNAPCAST_BUFF_LEN);
-    if (result) {
-      ESP_LOGI(TAG, "Failed to serialize time message\r\b");
-      return true;
-    }
-    p_client->write((const uint8_t *)&base_message_serialized[0],
-                    BASE_MESSAGE_SIZE);
-    p_client->write((const uint8_t *)&send_receive_buffer[0],
-                    TIME_MESSAGE_SIZE);
+    p_client->write(frame, sizeof(time_message_frame));
     return true;
   }
 
@@ -641,6 +1142,7 @@ protected:
   }
 
   size_t writeAudioInfo(SnapAudioHeader &header) {
+    audio_header = header;
     return p_snap_output->writeHeader(header);
   }
 };
@@ -5,7 +5,9 @@ namespace snap_arduino {
 
 /**
  * @brief Processor for which the encoded output is buffered in a ringbuffer in
- * order to prevent any buffer underruns.
+ * order to prevent any buffer underruns. The timestamp of each chunk is
+ * buffered as well, so that the sync is checked when the audio leaves the
+ * buffer.
  * @author Phil Schatzmann
  * @version 0.1
  * @date 2024-03-04
@@ -27,6 +29,8 @@ class SnapProcessorBuffered : public SnapProcessor {
     buffer.reset();
     sizes.reset();
     is_active = false;
+    has_pending = false;
+    is_silence_pending = false;
     return result;
   }
 
@@ -36,7 +40,13 @@ class SnapProcessorBuffered : public SnapProcessor {
       ESP_LOGE(TAG, "The buffer is too small. Use a multiple of %d", size);
       stop();
     }
-    sizes.write(size);
+    // the sync is checked at playout
+    SnapAudioHeader entry = audio_header;
+    entry.size = size;
+    if (!sizes.write(entry)) {
+      ESP_LOGW(TAG, "sizes full");
+      return 0;
+    }
     size_t result = buffer.writeArray(data, size);
     ESP_LOGI(TAG, "size: %zu / buffer %d", size, buffer.available());
 
@@ -46,19 +56,26 @@ class SnapProcessorBuffered : public SnapProcessor {
     return result;
   }
 
-  /// Decode from buffer
+  /// Decode from buffer: early entries are kept back, late entries are
+  /// dropped and underruns are concealed
   virtual void processExt() {
     if (isBufferActive()) {
-      int16_t step_size = sizes.read();
-      if (step_size > 0) {
-        uint8_t tmp[step_size];
-        int size_eff = buffer.readArray(tmp, step_size);
-        int size_written = SnapProcessor::writeAudio(tmp, size_eff);
-        if (size_written != size_eff) {
-          ESP_LOGE(TAG, "Could not write all data %d->%d", size_eff,
-                   size_written);
-        }
+      if (!has_pending) has_pending = sizes.read(pending);
+      SnapPlayout playout = SnapPlayoutWait;
+      if (is_silence_pending) {
+        // the entry has been accepted and follows the silence before it
+        playout = SnapPlayoutWrite;
+      } else if (has_pending) {
+        playout = p_snap_output->playout(pending);
+      }
+      // the silence is written in slices at the pace of the output
+      is_silence_pending =
+          playout == SnapPlayoutWrite && p_snap_output->writeSilence();
+      if (playout != SnapPlayoutWait && !is_silence_pending) {
+        has_pending = false;
+        copyEntry(pending.size, playout == SnapPlayoutWrite);
       }
+      if (playout == SnapPlayoutWait) p_snap_output->writeUnderrun();
     }
     delay(1);
   }
@@ -66,9 +83,31 @@ class SnapProcessorBuffered : public SnapProcessor {
  protected:
   const char *TAG = "SnapProcessorBuffered";
   RingBuffer<uint8_t> buffer{0};
-  RingBuffer<int16_t> sizes{RTOS_MAX_QUEUE_ENTRY_COUNT};
+  RingBuffer<SnapAudioHeader> sizes{RTOS_MAX_QUEUE_ENTRY_COUNT};
   bool is_active = false;
+  // entry which is kept back because it is early
+  SnapAudioHeader pending;
+  bool has_pending = false;
+  bool is_silence_pending = false;
   int active_percent;
+  // entries are not bigger than the parse buffer
+  uint8_t copy_buffer[CONFIG_SNAPCAST_BUFF_LEN];
+
+  /// Reads the entry from the buffer in slices and writes it to the output
+  void copyEntry(size_t size, bool isWrite) {
+    while (size > 0) {
+      size_t step_size = std::min(size, sizeof(copy_buffer));
+      int size_eff = buffer.readArray(copy_buffer, step_size);
+      if (size_eff <= 0) break;
+      size -= size_eff;
+      if (!isWrite) continue;
+      int size_written = p_snap_output->audioWrite(copy_buffer, size_eff);
+      if (size_written != size_eff) {
+        ESP_LOGE(TAG, "Could not write all data %d->%d", size_eff,
+                 size_written);
+      }
+    }
+  }
 
   bool isBufferActive() {
     if (!is_active) {
@@ -6,7 +6,9 @@ namespace snap_arduino {
 
 /**
  * @brief Processor for which the encoded output is buffered in a queue. The decoding and 
- * audio output can be done on the second core by calling loop1();
+ * audio output can be done on the second core by calling loop1(); The queue
+ * entries keep the timestamp of the chunks, so that the sync is checked when
+ * the audio leaves the queue.
  * 
  * @author Phil Schatzmann
  * @version 0.1
@@ -42,6 +44,7 @@ class SnapProcessorRP2040 : public SnapProcessor {
     size_queue.resize(RTOS_MAX_QUEUE_ENTRY_COUNT);
 
     is_active = false;
+    has_pending = false;
     return result;
   }
 
@@ -55,16 +58,34 @@ class SnapProcessorRP2040 : public SnapProcessor {
     ESP_LOGD(TAG, "doLoop1 %d / %d", size_queue.available(), buffer.available());
     if (!isBufferActive()) return true;
 
-    size_t size = 0;
-    if (size_queue.readArray(&size, 1)) {
-      uint8_t data[size];
-      int read = buffer.readArray(data, size);
-      if (read != size){
-        ESP_LOGE(TAG, "readArray failed %d -> %d", size, read);
+    if (!has_pending) has_pending = size_queue.readArray(&pending, 1) == 1;
+    if (!has_pending) {
+      p_snap_output->writeUnderrun();
+      return true;
+    }
+
+    // early entries are kept back and late entries are dropped
+    SnapPlayout playout = p_snap_output->playout(pending);
+    if (playout == SnapPlayoutWait) {
+      p_snap_output->writeUnderrun();
+      return true;
+    }
+    has_pending = false;
+
+    // the entry is copied in slices of the copy buffer
+    size_t size = pending.size;
+    while (size > 0) {
+      size_t step = std::min(size, sizeof(copy_buffer));
+      int read = buffer.readArray(copy_buffer, step);
+      if (read != step) {
+        ESP_LOGE(TAG, "readArray failed %d -> %d", step, read);
       }
-      int written = p_snap_output->audioWrite(data, size);
-      if (written != size) {
-        ESP_LOGE(TAG, "write error: %d of %d", written, size);
+      if (read <= 0) break;
+      size -= read;
+      if (playout == SnapPlayoutDrop) continue;
+      int written = p_snap_output->audioWrite(copy_buffer, read);
+      if (written != read) {
+        ESP_LOGE(TAG, "write error: %d of %d", written, read);
       }
     }
     return true;
@@ -72,11 +93,19 @@ class SnapProcessorRP2040 : public SnapProcessor {
 
  protected:
   const char *TAG = "SnapProcessorRP2040";
-  audio_tools::BufferRP2040T<size_t> size_queue{1, 0};
+  audio_tools::BufferRP2040T<SnapAudioHeader> size_queue{1, 0};
   audio_tools::BufferRP2040T<uint8_t> buffer{1024, 0};  // size defined in begin
   int buffer_count = 0;
   bool is_active = false;
+  // entry which is kept back because it is early
+  SnapAudioHeader pending;
+  bool has_pending = false;
   int active_percent = 0;
+  // entries are not bigger than the parse buffer
+  uint8_t copy_buffer[CONFIG_SNAPCAST_BUFF_LEN];
+
+  /// underruns are concealed by loop1() on the second core
+  void concealUnderrun() override {}
 
   bool isBufferActive() {
     if (!is_active && buffer.available()>0) {
@@ -113,11 +142,10 @@ class SnapProcessorRP2040 : public SnapProcessor {
       return 0;
     }
 
-    if (!p_snap_output->synchronizePlayback()) {
-      return size;
-    }
-
-    if (!size_queue.writeArray(&size, 1)) {
+    // the sync is checked at playout
+    SnapAudioHeader entry = audio_header;
+    entry.size = size;
+    if (!size_queue.writeArray(&entry, 1)) {
       ESP_LOGW(TAG, "size_queue full");
       return 0;
     }
@@ -11,6 +11,8 @@ namespace snap_arduino {
 /**
  * @brief Processor for which the encoded output is buffered in a queue in order to
  * prevent any buffer underruns. A RTOS task feeds the output from the queue.
+ * The queue entries keep the timestamp of the chunks, so that the sync is
+ * checked when the audio leaves the queue.
  * @author Phil Schatzmann
  * @version 0.1
  * @date 2024-02-26
@@ -36,6 +38,8 @@ class SnapProcessorRTOS : public SnapProcessor {
     // allocate buffer, so that we could use psram
     size_queue.resize(RTOS_MAX_QUEUE_ENTRY_COUNT);
     size_queue.setWriteMaxWait(5);
+    // do not block, so that we can handle underruns
+    size_queue.setReadMaxWait(0);
     buffer.resize(buffer_size);
     return result;
   }
@@ -45,17 +49,23 @@ class SnapProcessorRTOS : public SnapProcessor {
     task_started = false;
     size_queue.clear();
     buffer.reset();
+    has_pending = false;
     SnapProcessor::end();
   }
 
  protected:
   const char *TAG = "SnapProcessorRTOS";
   audio_tools::Task task{"output", RTOS_STACK_SIZE, RTOS_TASK_PRIORITY, 1};
-  audio_tools::QueueRTOS<size_t> size_queue{0};
+  audio_tools::QueueRTOS<SnapAudioHeader> size_queue{0};
   audio_tools::BufferRTOS<uint8_t> buffer{0}; // size defined in constructor
   bool task_started = false;
+  // entry which is kept back because it is early
+  SnapAudioHeader pending;
+  bool has_pending = false;
   int active_percent;
   int buffer_size;
+  // entries are not bigger than the parse buffer
+  uint8_t copy_buffer[CONFIG_SNAPCAST_BUFF_LEN];
   static SnapProcessorRTOS *self;
 
   /// store parameters provided by constructor
@@ -79,11 +89,10 @@ class SnapProcessorRTOS : public SnapProcessor {
       return 0;
     }
 
-    if (!p_snap_output->synchronizePlayback()) {
-      return size;
-    }
-
-    if (!size_queue.enqueue(size)) {
+    // the sync is checked at playout
+    SnapAudioHeader entry = audio_header;
+    entry.size = size;
+    if (!size_queue.enqueue(entry)) {
       ESP_LOGW(TAG, "size_queue full");
       return 0;
     }
@@ -104,26 +113,46 @@ class SnapProcessorRTOS : public SnapProcessor {
     return size_written;
   }
 
+  /// underruns are concealed by the output task
+  void concealUnderrun() override {}
+
   /// Determines the buffer fill limit at which we start to process the data
   int bufferTaskActivationLimit() {
     return static_cast<float>(active_percent) / 100.0 * buffer.size();
   }
 
-  /// Copy the buffered data to the output
+  /// Copy the buffered data to the output: early entries are kept back, late
+  /// entries are dropped and underruns are concealed
   void copy() {
-    size_t size = 0;
-    if (size_queue.dequeue(size)) {
-      uint8_t data[size];
-      int read = buffer.readArray(data, size);
-      assert(read == size);
-      int written = p_snap_output->audioWrite(data, size);
-      if (written != size) {
-        ESP_LOGW(TAG, "write %d of %d", written, size);
+    if (!has_pending) has_pending = size_queue.dequeue(pending);
+    SnapPlayout playout = SnapPlayoutWait;
+    if (has_pending) {
+      playout = p_snap_output->playout(pending);
+      if (playout != SnapPlayoutWait) {
+        copyEntry(pending.size, playout == SnapPlayoutWrite);
+        has_pending = false;
       }
     }
+    if (playout == SnapPlayoutWait) p_snap_output->writeUnderrun();
     delay(1);
   }
 
+  /// Reads the entry from the buffer in slices and writes it to the output
+  void copyEntry(size_t size, bool isWrite) {
+    while (size > 0) {
+      size_t step = std::min(size, sizeof(copy_buffer));
+      int read = buffer.readArray(copy_buffer, step);
+      assert(read == step);
+      if (read <= 0) break;
+      size -= read;
+      if (!isWrite) continue;
+      int written = p_snap_output->audioWrite(copy_buffer, read);
+      if (written != read) {
+        ESP_LOGW(TAG, "write %d of %d", written, read);
+      }
+    }
+  }
+
   /// static method for rtos task: make sure we constantly output audio
   static void task_copy() {
     while (self != nullptr) self->copy();
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "SnapConfig.h"
+#include "SnapJson.h"
 #include "SnapLogger.h"
 #include <stdbool.h>
 #include <stddef.h>
@@ -12,14 +13,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #define BASE_MESSAGE_SIZE 26
 #define TIME_MESSAGE_SIZE 8
+#define WIRE_CHUNK_HEADER_SIZE 12
 #define MAX_JSON_LEN 256
 
 namespace snap_arduino {
 
+template <typename T, size_t... I>
+constexpr T snapReadLE(const uint8_t *data, std::index_sequence<I...>) {
+  using U = typename std::make_unsigned<T>::type;
+  return static_cast<T>(
+      (static_cast<U>(static_cast<U>(data[I]) << (8 * I)) | ...));
+}
+
+template <typename T, size_t... I>
+constexpr void snapWriteLE(uint8_t *data, T value, std::index_sequence<I...>) {
+  using U = typename std::make_unsigned<T>::type;
+  ((data[I] = static_cast<uint8_t>(static_cast<U>(value) >> (8 * I))), ...);
+}
+
+/// Reads a little endian value: the unrolled byte access is reduced by the
+/// compiler to a single load on little endian targets
+template <typename T>
+constexpr T snapReadLE(const uint8_t *data) {
+  return snapReadLE<T>(data, std::make_index_sequence<sizeof(T)>{});
+}
+
+/// Writes a value in little endian byte order: on little endian targets this
+/// is reduced to a single store
+template <typename T>
+constexpr void snapWriteLE(uint8_t *data, T value) {
+  snapWriteLE<T>(data, value, std::make_index_sequence<sizeof(T)>{});
+}
+
 /// @brief Buffer to read different data types
 struct SnapReadBuffer {
   const char *buffer;
@@ -32,78 +63,47 @@ struct SnapReadBuffer {
   }
 
   int read(char *data, size_t size) {
-    int i;
-
     if (this->size - this->index < size) {
       return 1;
     }
 
-    for (i = 0; i < size; i++) {
-      data[i] = this->buffer[this->index++];
-    }
-
+    memcpy(data, this->buffer + this->index, size);
+    this->index += size;
     return 0;
   }
 
-  int read_uint32(uint32_t *data) {
-    if (this->size - this->index < sizeof(uint32_t)) {
+  /// provides a view on the next size bytes without copying them
+  int read_view(SnapView *view, size_t size) {
+    if (this->size - this->index < size) {
       return 1;
     }
 
-    *data = this->buffer[this->index++] & 0xff;
-    *data |= (this->buffer[this->index++] & 0xff) << 8;
-    *data |= (this->buffer[this->index++] & 0xff) << 16;
-    *data |= (this->buffer[this->index++] & 0xff) << 24;
+    view->data = this->buffer + this->index;
+    view->size = size;
+    this->index += size;
     return 0;
   }
 
-  int read_uint16(uint16_t *data) {
-    if (this->size - this->index < sizeof(uint16_t)) {
-      return 1;
-    }
+  int read_uint32(uint32_t *data) { return read_le(data); }
 
-    *data = this->buffer[this->index++] & 0xff;
-    *data |= (this->buffer[this->index++] & 0xff) << 8;
-    return 0;
-  }
+  int read_uint16(uint16_t *data) { return read_le(data); }
 
-  int read_uint8(uint8_t *data) {
-    if (this->size - this->index < sizeof(uint8_t)) {
-      return 1;
-    }
+  int read_uint8(uint8_t *data) { return read_le(data); }
 
-    *data = this->buffer[this->index++] & 0xff;
-    return 0;
-  }
+  int read_int32(int32_t *data) { return read_le(data); }
 
-  int read_int32(int32_t *data) {
-    if (this->size - this->index < sizeof(int32_t)) {
-      return 1;
-    }
+  int read_int16(int16_t *data) { return read_le(data); }
 
-    *data = this->buffer[this->index++] & 0xff;
-    *data |= (this->buffer[this->index++] & 0xff) << 8;
-    *data |= (this->buffer[this->index++] & 0xff) << 16;
-    *data |= (this->buffer[this->index++] & 0xff) << 24;
-    return 0;
-  }
+  int read_int8(int8_t *data) { return read_le(data); }
 
-  int read_int16(int16_t *data) {
-    if (this->size - this->index < sizeof(int16_t)) {
-      return 1;
-    }
-
-    *data = this->buffer[this->index++] & 0xff;
-    *data |= (this->buffer[this->index++] & 0xff) << 8;
-    return 0;
-  }
-
-  int read_int8(int8_t *data) {
-    if (this->size - this->index < sizeof(int8_t)) {
+protected:
+  template <typename T> int read_le(T *data) {
+    if (this->size - this->index < sizeof(T)) {
       return 1;
     }
 
-    *data = this->buffer[this->index++] & 0xff;
+    *data = snapReadLE<T>((const uint8_t *)this->buffer + this->index);
+    this->index += sizeof(T);
     return 0;
   }
 };
@@ -120,78 +120,35 @@ struct SnapWriteBuffer {
   }
 
   int write(const char *data, size_t size) {
-    int i;
-
     if (this->size - this->index < size) {
       return 1;
     }
 
-    for (i = 0; i < size; i++) {
-      this->buffer[this->index++] = data[i];
-    }
-
-    return 0;
-  }
-
-  int write_uint32(uint32_t data) {
-    if (this->size - this->index < sizeof(uint32_t)) {
-      return 1;
-    }
-
-    this->buffer[this->index++] = data & 0xff;
-    this->buffer[this->index++] = (data >> 8) & 0xff;
-    this->buffer[this->index++] = (data >> 16) & 0xff;
-    this->buffer[this->index++] = (data >> 24) & 0xff;
-    return 0;
-  }
-
-  int write_uint16(uint16_t data) {
-    if (this->size - this->index < sizeof(uint16_t)) {
-      return 1;
-    }
-
-    this->buffer[this->index++] = data & 0xff;
-    this->buffer[this->index++] = (data >> 8) & 0xff;
+    memcpy(this->buffer + this->index, data, size);
+    this->index += size;
     return 0;
   }
 
-  int write_uint8(uint8_t data) {
-    if (this->size - this->index < sizeof(uint8_t)) {
-      return 1;
-    }
+  int write_uint32(uint32_t data) { return write_le(data); }
 
-    this->buffer[this->index++] = data & 0xff;
-    return 0;
-  }
+  int write_uint16(uint16_t data) { return write_le(data); }
 
-  int write_int32(int32_t data) {
-    if (this->size - this->index < sizeof(int32_t)) {
-      return 1;
-    }
+  int write_uint8(uint8_t data) { return write_le(data); }
 
-    this->buffer[this->index++] = data & 0xff;
-    this->buffer[this->index++] = (data >> 8) & 0xff;
-    this->buffer[this->index++] = (data >> 16) & 0xff;
-    this->buffer[this->index++] = (data >> 24) & 0xff;
-    return 0;
-  }
+  int write_int32(int32_t data) { return write_le(data); }
 
-  int write_int16(int16_t data) {
-    if (this->size - this->index < sizeof(int16_t)) {
-      return 1;
-    }
+  int write_int16(int16_t data) { return write_le(data); }
 
-    this->buffer[this->index++] = data & 0xff;
-    this->buffer[this->index++] = (data >> 8) & 0xff;
-    return 0;
-  }
+  int write_int8(int8_t data) { return write_le(data); }
 
-  int write_int8(int8_t data) {
-    if (this->size - this->index < sizeof(int8_t)) {
+protected:
+  template <typename T> int write_le(T data) {
+    if (this->size - this->index < sizeof(T)) {
       return 1;
     }
 
-    this->buffer[this->index++] = data & 0xff;
+    snapWriteLE<T>((uint8_t *)this->buffer + this->index, data);
+    this->index += sizeof(T);
     return 0;
   }
 };
@@ -216,6 +173,11 @@ struct tv_t {
 
 /// @brief Snapcast Base Message
 struct SnapMessageBase {
+  /// positions of the fields in the serialized message
+  static constexpr int ID_POS = 2;
+  static constexpr int SENT_POS = 6;
+  static constexpr int RECEIVED_POS = 14;
+
   uint16_t type;
   uint16_t id;
   uint16_t refersTo;
@@ -319,90 +281,115 @@ struct SnapMessageServerSettings {
   uint32_t volume = 0;
   bool muted = false;
 
-  int deserialize(const char *json) {
-    if (json == nullptr)
+  /// parses e.g. {"bufferMs":1000,"latency":0,"muted":false,"volume":57}
+  /// which is prefixed by the length
+  int deserialize(const char *data, uint32_t reqSize) {
+    SnapReadBuffer buffer;
+    uint32_t json_size = 0;
+    SnapView json;
+
+    buffer.begin(data, reqSize);
+    if (buffer.read_uint32(&json_size) || buffer.read_view(&json, json_size)) {
       return 1;
-    ESP_LOGD("SnapMessageServerSettings", "%s", json);
-
-    // Removed dependency to json library: this should be good enough!
-    audio_tools::Str json_str(json);
-    // parse e.g. {"bufferMs":1000,"latency":0,"muted":false,"volume":57}:
-    int idx = json_str.indexOf("bufferMs");
-    if (idx > 0) {
-      buffer_ms = atoi(json + idx + 10);
-      ESP_LOGD(TAG, "bufferMs: %d", buffer_ms);
     }
-    idx = json_str.indexOf("latency");
-    if (idx > 0) {
-      latency = atoi(json + idx + 9);
-      ESP_LOGD(TAG, "latency: %d", latency);
+    ESP_LOGD(TAG, "%.*s", (int)json.size, json.data);
+
+    SnapJsonReader reader(json);
+    SnapView key, value;
+    while (reader.next(key, value)) {
+      if (key.equals("bufferMs")) {
+        SnapJsonReader::toInt(value, buffer_ms);
+      } else if (key.equals("latency")) {
+        SnapJsonReader::toInt(value, latency);
+      } else if (key.equals("volume")) {
+        int32_t vol = volume;
+        if (SnapJsonReader::toInt(value, vol) && vol >= 0) volume = vol;
+      } else if (key.equals("muted")) {
+        SnapJsonReader::toBool(value, muted);
+      }
     }
-    idx = json_str.indexOf("volume");
-    if (idx > 0) {
-      volume = atoi(json + idx + 8);
-      ESP_LOGD(TAG, "volume: %d", volume);
+    return reader.isError() ? 1 : 0;
+  }
+
+protected:
+  const char *TAG = "SnapMessageServerSettings";
+};
+
+/// @brief Snapcast Stream Tags Message: the json is only parsed for the
+/// fields which are requested
+struct SnapMessageStreamTags {
+  SnapView json;
+
+  int deserialize(const char *data, uint32_t reqSize) {
+    SnapReadBuffer buffer;
+    uint32_t json_size = 0;
+
+    buffer.begin(data, reqSize);
+    if (buffer.read_uint32(&json_size)) {
+      return 1;
     }
-    idx = json_str.indexOf("muted");
-    if (idx > 0) {
-      // set to true if we find a true string
-      muted = json_str.indexOf("true") > idx;
-      ESP_LOGD(TAG, "muted: %s", muted ? "true" : "false");
+    return buffer.read_view(&json, json_size);
+  }
+
+  /// Provides the raw json value of a top level field
+  bool get(const char *key, SnapView &value) {
+    SnapJsonReader reader(json);
+    return reader.find(key, value);
+  }
+
+  /// Provides a string value: for arrays (e.g. artist) the first entry is
+  /// returned
+  bool getString(const char *key, char *str, size_t len) {
+    SnapView value;
+    if (!get(key, value)) return false;
+    if (value.size > 0 && value.data[0] == '[') {
+      SnapJsonReader array(value);
+      if (!array.next(value)) return false;
     }
+    return SnapJsonReader::toString(value, str, len);
+  }
 
-    return 0;
+  /// Provides a number value
+  bool getInt(const char *key, int32_t &result) {
+    SnapView value;
+    return get(key, value) && SnapJsonReader::toInt(value, result);
   }
 };
 
-/// @brief Snapcast Codec Header Message
+/// @brief Snapcast Codec Header Message: the codec name and the payload point
+/// into the provided data, so it must stay valid while the message is used
 struct SnapMessageCodecHeader {
-  std::vector<char> v_codec;
-  uint32_t size;
-  std::vector<char> v_payload;
-
-  char *payload() { return &v_payload[0]; }
-  char *codec() { return &v_codec[0]; }
+  SnapView codec;
+  uint32_t size = 0;
+  char *payload = nullptr;
 
   int deserialize(const char *data, uint32_t reqSize) {
     SnapReadBuffer buffer;
-    uint32_t string_size;
-    int result = 0;
-    
+    uint32_t string_size = 0;
+
     buffer.begin(data, reqSize);
 
-    result |= buffer.read_uint32(&string_size);
-    if (result) {
-      // Can\"t allocate the proper size string if we didn\"t read the size, so
-      // fail early
+    if (buffer.read_uint32(&string_size)) {
       return 1;
     }
-
-    if (v_codec.size() < string_size + 1)
-      v_codec.resize(string_size + 1);
-
-    result |= buffer.read(codec(), string_size);
-    // Make sure the codec is a proper C string by terminating it with a null
-    // character
-    this->codec()[string_size] = '\0';
-
-    result |= buffer.read_uint32(&(this->size));
-    if (result) {
-      // Can't allocate the proper size string if we didn't read the size, so
-      // fail early
+    if (buffer.read_view(&codec, string_size) ||
+        buffer.read_uint32(&(this->size))) {
       return 1;
     }
 
-    if (v_payload.size() < reqSize)
-      v_payload.resize(reqSize);
-
-    result |= buffer.read(payload(), this->size);
-    return result;
+    SnapView payload_view;
+    if (buffer.read_view(&payload_view, this->size)) {
+      return 1;
+    }
+    this->payload = (char *)payload_view.data;
+    return 0;
   }
 };
 
 /// @brief Snapcast Wire Chunk Message
 struct SnapMessageWireChunk {
   tv_t timestamp;
-  uint32_t size;
+  uint32_t size = 0;
   char *payload = nullptr;
 
   int deserialize(const char *data, uint32_t reqSize) {
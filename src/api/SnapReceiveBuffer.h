@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace snap_arduino {
+
+/**
+ * @brief Ring buffer for the data received from the server. The free space is
+ * provided as contiguous memory, so that the client can read directly into it
+ * with one call.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapReceiveBuffer {
+ public:
+  /// Allocates the memory: 0 releases it
+  void resize(size_t size) {
+    buffer.resize(size);
+    buffer.shrink_to_fit();
+    reset();
+  }
+
+  /// Removes all data
+  void reset() {
+    read_pos = 0;
+    count = 0;
+  }
+
+  size_t size() { return buffer.size(); }
+
+  /// Number of bytes which can be read
+  size_t available() { return count; }
+
+  /// Provides the contiguous free memory and its length
+  uint8_t *writeBuffer(size_t &len) {
+    if (count == 0) read_pos = 0;  // maximize the contiguous space
+    size_t write_pos = (read_pos + count) % std::max(size(), (size_t)1);
+    if (count == size()) {
+      len = 0;
+    } else if (write_pos >= read_pos) {
+      len = size() - write_pos;
+    } else {
+      len = read_pos - write_pos;
+    }
+    return buffer.data() + write_pos;
+  }
+
+  /// Confirms the number of bytes written to the writeBuffer()
+  void commitWrite(size_t len) { count += len; }
+
+  /// Copies the data to the indicated target
+  size_t read(uint8_t *data, size_t len) {
+    len = std::min(len, count);
+    size_t first = std::min(len, size() - read_pos);
+    memcpy(data, buffer.data() + read_pos, first);
+    memcpy(data + first, buffer.data(), len - first);
+    return skip(len);
+  }
+
+  /// Removes the data w/o copying it
+  size_t skip(size_t len) {
+    len = std::min(len, count);
+    if (len == 0) return 0;
+    read_pos = (read_pos + len) % size();
+    count -= len;
+    return len;
+  }
+
+ protected:
+  std::vector<uint8_t> buffer;
+  size_t read_pos = 0;
+  size_t count = 0;
+};
+
+}  // namespace snap_arduino
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+namespace snap_arduino {
+
+/**
+ * @brief Publishes a value from one task (e.g. the network task) to other
+ * tasks (e.g. the audio output task) w/o locking. The writer copies the value
+ * into the slot which is not published and then switches the slot by
+ * updating the sequence number. A reader only needs to retry if the writer
+ * started to overwrite the slot while it was copying it, so it is never
+ * blocked by an interrupted writer. Only one task may call set().
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+template <typename T>
+class SnapSnapshot {
+ public:
+  SnapSnapshot() { set(T()); }
+  SnapSnapshot(const T &value) { set(value); }
+
+  /// Publishes a new value
+  void set(const T &value) {
+    uint32_t words[WORDS] = {0};
+    memcpy(words, &value, sizeof(T));
+    // odd sequence numbers mark an update in progress
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto &slot = slots[(seq / 2 + 1) & 1];
+    for (size_t j = 0; j < WORDS; j++) {
+      slot[j].store(words[j], std::memory_order_relaxed);
+    }
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  /// Provides a consistent copy of the last published value
+  T get() const {
+    uint32_t words[WORDS];
+    while (true) {
+      uint32_t seq = sequence.load(std::memory_order_acquire);
+      uint32_t published = seq / 2;
+      auto &slot = slots[published & 1];
+      for (size_t j = 0; j < WORDS; j++) {
+        words[j] = slot[j].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // the slot is only overwritten by the second next update
+      if (sequence.load(std::memory_order_relaxed) - 2 * published < 3) break;
+    }
+    T result;
+    memcpy(&result, words, sizeof(T));
+    return result;
+  }
+
+ protected:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SnapSnapshot needs a trivially copyable type");
+  // the value is copied with 32 bit atomics which are lock free on all targets
+  static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+  std::atomic<uint32_t> slots[2][WORDS];
+  std::atomic<uint32_t> sequence{0};
+};
+
+}  // namespace snap_arduino
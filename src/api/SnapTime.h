@@ -2,13 +2,34 @@
 #include "AudioTools/CoreAudio/AudioBasic/Collections/Vector.h"
 #include <stdint.h>
 #include <sys/time.h>
+#include <algorithm>
+#include "SnapSnapshot.h"
+#if defined(ESP32)
+#  include "esp_timer.h"
+#elif defined(ARDUINO_ARCH_RP2040)
+#  include "hardware/timer.h"
+#elif defined(__linux__)
+#  include <time.h>
+#endif
 
 namespace snap_arduino {
 
+/// Selects how the time difference is determined from the collected samples
+enum SnapTimeFilter {
+  /// median of the time differences (like the reference snapclient)
+  SnapTimeFilterMedian,
+  /// time difference of the sample with the smallest round trip time
+  SnapTimeFilterMinRTT
+};
+
 /**
- * @brief The the sys/time functions are used to represent the server time.
- * The local time will be measured with the help of the Arduino millis() method.
- * This class provides the basic functionality to translate between local and server time.
+ * @brief The local time is measured in microseconds with a 64 bit monotonic
+ * clock, so it does not wrap around and is not impacted by (SNTP) changes of
+ * the wall clock. The server time is represented by the local time minus the
+ * filtered time difference. This class provides the basic functionality to
+ * translate between local and server time. The time difference is
+ * determined by the task which processes the time messages and is published
+ * as snapshot, so that the conversions can be called from any task.
  * @author Phil Schatzmann
  * @version 0.1
  * @date 2023-10-28
@@ -21,7 +42,33 @@ public:
     return self;
   }
 
-  /// Provides the actual time as timeval
+  /// Provides the monotonic local time in microseconds
+  static int64_t localMicros() {
+#if defined(ESP32)
+    return esp_timer_get_time();
+#elif defined(__linux__)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#elif defined(ARDUINO_ARCH_RP2040)
+    // 64 bit hardware timer which can be read from both cores
+    return time_us_64();
+#else
+    // extend the 32 bit micros() which wraps around after 71 minutes
+    static uint32_t last_us = 0;
+    static int64_t high = 0;
+    uint32_t us = micros();
+    if (us < last_us) high += (int64_t)1 << 32;
+    last_us = us;
+    return high + us;
+#endif
+  }
+
+  /// Provides the monotonic local time as timeval: used for the timestamps
+  /// in the messages
+  timeval monotonicTime() { return toTimeval(localMicros()); }
+
+  /// Provides the actual (wall clock) time as timeval
   timeval time() {
     timeval result;
     int rc = gettimeofday(&result, NULL);
@@ -33,27 +80,109 @@ public:
     return result;
   }
 
+  /// Provides the current server time in us
+  int64_t serverMicros() { return localMicros() - published_diff_us.get(); }
+
   /// Provides the current server time in ms
-  uint32_t serverMillis() {
-    return toMillis(server_time) - server_ms + millis() -
-           timeDifferenceClientServerMs();
-  }
+  int64_t serverMillis() { return serverMicros() / 1000; }
+
+  /// Provides the monotonic local time in ms
+  int64_t localMillis() { return localMicros() / 1000; }
 
-  uint32_t localMillis() { return toMillis(time()); }
+  /// Converts a server time to the local time in us
+  int64_t toLocalMicros(int64_t serverUs) {
+    return serverUs + published_diff_us.get();
+  }
 
-  /// Provides the avg latecy in milliseconds
+  /// Provides the filtered time difference (local - server) in milliseconds
   int timeDifferenceClientServerMs() {
-    int result = time_diff;
-    assert(result == time_diff);
-    return result;
+    return timeDifferenceClientServerUs() / 1000;
+  }
+
+  /// Provides the filtered time difference (local - server) in microseconds
+  int64_t timeDifferenceClientServerUs() { return published_diff_us.get(); }
+
+  /// Provides the confidence of the time difference as +- error estimate in
+  /// microseconds: the smaller the better, -1 if there are no samples yet
+  int32_t timeDifferenceErrorUs() { return time_diff_error_us; }
+
+  /// Provides the round trip time of the last time message in microseconds
+  int32_t roundTripTimeUs() { return last_rtt_us; }
+
+  /// Provides the smallest round trip time in the filter window in microseconds
+  int32_t minRoundTripTimeUs() { return min_rtt_us; }
+
+  /// Number of samples which are used by the filter
+  int timeSampleCount() { return time_samples.size(); }
+
+  /// Defines how the samples are filtered (default SnapTimeFilterMedian)
+  void setTimeFilter(SnapTimeFilter filter) { time_filter = filter; }
+
+  /// Defines the number of time messages that are used by the filter
+  void setTimeFilterSize(int size) {
+    time_filter_size = std::max(1, size);
+    resetTimeSamples();
+  }
+
+  /// Removes all collected time samples
+  void resetTimeSamples() {
+    time_samples.clear();
+    sample_pos = 0;
+    time_diff_error_us = -1;
+  }
+
+  /// Checks if the result of a time message exchange agrees with the filtered
+  /// time difference within the error bounds of both: e.g. after a reconnect
+  /// the server might have been restarted with a different clock
+  bool isConsistent(int64_t c2sUs, int64_t s2cUs) {
+    if (time_samples.empty()) return true;
+    int64_t diff_us = (s2cUs - c2sUs) / 2;
+    int64_t rtt_us = std::max((int64_t)0, c2sUs + s2cUs);
+    int64_t bound_us = rtt_us / 2 + std::max((int32_t)0, time_diff_error_us);
+    int64_t delta_us = diff_us - time_diff_us;
+    return delta_us <= bound_us && -delta_us <= bound_us;
+  }
+
+  /// Records the result of a time message exchange: c2s is the client to
+  /// server (and s2c the server to client) difference of the receive and the
+  /// sent time, so each contains the clock offset and the one way delay.
+  /// Returns the round trip time in microseconds.
+  int32_t addTimeSample(int64_t c2sUs, int64_t s2cUs) {
+    TimeSample sample;
+    // (local - server) w/o the network delay if the delay is symmetric
+    sample.diff_us = (s2cUs - c2sUs) / 2;
+    sample.rtt_us = std::max((int64_t)0, c2sUs + s2cUs);
+    last_rtt_us = sample.rtt_us;
+
+    // ring buffer with the last time_filter_size samples
+    if ((size_t)time_samples.size() < time_filter_size) {
+      time_samples.push_back(sample);
+    } else {
+      time_samples[sample_pos] = sample;
+      sample_pos = (sample_pos + 1) % time_filter_size;
+    }
+    updateTimeDifference();
+    published_diff_us.set(time_diff_us);
+    return last_rtt_us;
   }
 
-  uint32_t toMillis(timeval tv) { return toMillis(tv.tv_sec, tv.tv_usec); }
+  int64_t toMillis(timeval tv) { return toMillis(tv.tv_sec, tv.tv_usec); }
 
-  inline uint32_t toMillis(uint32_t sec, uint32_t usec) {
+  inline int64_t toMillis(int64_t sec, int64_t usec) {
     return sec * 1000 + (usec / 1000);
   }
 
+  inline int64_t toMicros(int64_t sec, int64_t usec) {
+    return sec * 1000000 + usec;
+  }
+
+  inline timeval toTimeval(int64_t us) {
+    timeval result;
+    result.tv_sec = us / 1000000;
+    result.tv_usec = us % 1000000;
+    return result;
+  }
+
   bool printLocalTime(const char *msg) {
     const timeval val = time();
     auto *tm_result = gmtime(&val.tv_sec);
@@ -64,16 +193,10 @@ public:
     return true;
   }
 
-  /// Record the last time difference between client and server
-  void setTimeDifferenceClientServerMs(uint32_t diff) {
-    time_diff = diff;
-    time_update_count++;
-  }
-
-  // updates the time difference between the local and server time
-  void updateServerTime(timeval &server) {
-    server_ms = millis();
-    server_time = server;
+  /// Overwrites the time difference between client and server (w/o filter)
+  void setTimeDifferenceClientServerMs(int32_t diff) {
+    time_diff_us = (int64_t)diff * 1000;
+    published_diff_us.set(time_diff_us);
   }
 
   // Calculat the difference between 2 timeval
@@ -84,7 +207,7 @@ public:
   }
 
   // Calculat the difference between 2 timeval -> result in ms
-  uint32_t timeDifferenceMs(timeval t1, timeval t2) {
+  int64_t timeDifferenceMs(timeval t1, timeval t2) {
     timeval result;
     timersub(&t1, &t2, &result);
     return toMillis(result);
@@ -110,14 +233,78 @@ public:
 #endif
 
 protected:
+  struct TimeSample {
+    int64_t diff_us;
+    int32_t rtt_us;
+  };
   const char *TAG = "SnapTime";
-  uint32_t time_diff = 0;
-  uint32_t server_ms = 0;
-  uint32_t local_ms;
-  uint32_t time_update_count = 0;
-  timeval server_time;
+  int64_t time_diff_us = 0;
+  SnapSnapshot<int64_t> published_diff_us{0};
+  int32_t time_diff_error_us = -1;
+  int32_t last_rtt_us = 0;
+  int32_t min_rtt_us = 0;
+  SnapTimeFilter time_filter = SnapTimeFilterMedian;
+  size_t time_filter_size = CONFIG_SNAPCAST_TIME_FILTER_SIZE;
+  size_t sample_pos = 0;
+  Vector<TimeSample> time_samples;
+  Vector<int64_t> sorted_diffs;
   bool has_sntp_time = false;
-  
+
+  /// Determines the time difference and its error from the samples
+  void updateTimeDifference() {
+    int count = time_samples.size();
+    int min_idx = 0;
+    for (int j = 1; j < count; j++) {
+      if (time_samples[j].rtt_us < time_samples[min_idx].rtt_us) min_idx = j;
+    }
+    min_rtt_us = time_samples[min_idx].rtt_us;
+
+    if (time_filter == SnapTimeFilterMinRTT) {
+      // the asymmetry of the delay is at most half of the round trip time
+      time_diff_us = time_samples[min_idx].diff_us;
+      time_diff_error_us = min_rtt_us / 2;
+      return;
+    }
+
+    // median: the error is estimated by half of the interquartile range
+    sorted_diffs.resize(count);
+    for (int j = 0; j < count; j++) sorted_diffs[j] = time_samples[j].diff_us;
+    int64_t *begin = sorted_diffs.data();
+    int64_t *end = begin + count;
+    std::nth_element(begin, begin + count / 2, end);
+    time_diff_us = begin[count / 2];
+    std::nth_element(begin, begin + count / 4, end);
+    int64_t q1 = begin[count / 4];
+    std::nth_element(begin, begin + (3 * count) / 4, end);
+    int64_t q3 = begin[(3 * count) / 4];
+    time_diff_error_us = (q3 - q1) / 2;
+  }
+};
+
+/// Recording of the local and server time in us
+struct SnapTimePoints {
+  int64_t local_us = SnapTime::localMicros();
+  int64_t server_us = 0;
+  SnapTimePoints() = default;
+  SnapTimePoints(int64_t serverUs) { server_us = serverUs; }
+  SnapTimePoints(int64_t serverUs, int64_t localUs) {
+    server_us = serverUs;
+    local_us = localUs;
+  }
+};
+
+/**
+ * @brief Source of the local time which is used to measure the drift to the
+ * server clock: by default this is the monotonic CPU clock.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapTimebase {
+public:
+  /// Provides the local time in us
+  virtual int64_t localMicros() = 0;
 };
 
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "SnapConfig.h"
+#include "SnapLogger.h"
+#include "SnapTime.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Decides when the next time message needs to be sent: after the
+ * hello we send the requests in a short interval until the time difference
+ * is stable. Then the interval is doubled with each answer up to the steady
+ * state interval. If the variation of the round trip time rises, the
+ * interval is halved again.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapTimeScheduler {
+ public:
+  /// Starts with the burst: call after the hello has been sent
+  void begin() {
+    interval_us = burst_interval_us;
+    next_us = SnapTime::localMicros();
+    sample_count = 0;
+    rtt_mean_us = 0;
+    rtt_dev_us = 0;
+    rtt_dev_baseline_us = 0;
+    is_burst = true;
+  }
+
+  /// Returns true if the next time message needs to be sent
+  bool isDue() { return SnapTime::localMicros() - next_us >= 0; }
+
+  /// Confirms that the time message has been sent
+  void setSent() { next_us = SnapTime::localMicros() + interval_us; }
+
+  /// Records the result of a time message: the round trip time and the
+  /// error of the filtered time difference (in us)
+  void addSample(int32_t rttUs, int32_t errorUs) {
+    sample_count++;
+    updateRTTStatistics(rttUs);
+
+    if (is_burst) {
+      bool is_stable = sample_count >= burst_count && errorUs >= 0 &&
+                       errorUs <= stable_error_us;
+      // we do not want to stay in the burst forever
+      if (!is_stable && sample_count < 4 * burst_count) return;
+      ESP_LOGI(TAG, "time difference stable after %d messages (+-%d us)",
+               sample_count, (int)errorUs);
+      is_burst = false;
+    }
+
+    if (rtt_dev_us > 2 * rtt_dev_baseline_us + min_jitter_us) {
+      // the network got less reliable: more samples for the filter
+      interval_us = std::max(burst_interval_us, interval_us / 2);
+    } else {
+      interval_us = std::min(steady_interval_us, interval_us * 2);
+    }
+  }
+
+  /// Defines the interval that is used when the time difference is stable
+  void setInterval(int ms) { steady_interval_us = (int64_t)ms * 1000; }
+
+  /// Defines the interval and the min number of messages of the burst
+  void setBurst(int ms, int count) {
+    burst_interval_us = (int64_t)ms * 1000;
+    burst_count = count;
+  }
+
+  /// The burst ends when the time difference error is below this value
+  void setStableError(int32_t us) { stable_error_us = us; }
+
+  /// Provides the actual interval in ms
+  int interval() { return interval_us / 1000; }
+
+  /// Returns true during the startup burst
+  bool isBurst() { return is_burst; }
+
+ protected:
+  const char *TAG = "SnapTimeScheduler";
+  int64_t steady_interval_us = (int64_t)CONFIG_SNAPCAST_TIME_INTERVAL_MS * 1000;
+  int64_t burst_interval_us =
+      (int64_t)CONFIG_SNAPCAST_TIME_BURST_INTERVAL_MS * 1000;
+  int burst_count = CONFIG_SNAPCAST_TIME_BURST_COUNT;
+  int32_t stable_error_us = CONFIG_SNAPCAST_TIME_STABLE_ERROR_US;
+  int32_t min_jitter_us = 1000;
+  int64_t interval_us = burst_interval_us;
+  int64_t next_us = 0;
+  int sample_count = 0;
+  int32_t rtt_mean_us = 0;
+  int32_t rtt_dev_us = 0;
+  int32_t rtt_dev_baseline_us = 0;
+  bool is_burst = true;
+
+  /// smoothed round trip time and deviation (like the TCP retransmission
+  /// timer) and a slow baseline of the deviation
+  void updateRTTStatistics(int32_t rttUs) {
+    if (sample_count == 1) {
+      rtt_mean_us = rttUs;
+      rtt_dev_us = rttUs / 2;
+      rtt_dev_baseline_us = rtt_dev_us;
+      return;
+    }
+    rtt_dev_us += (abs(rttUs - rtt_mean_us) - rtt_dev_us) / 4;
+    rtt_mean_us += (rttUs - rtt_mean_us) / 8;
+    rtt_dev_baseline_us += (rtt_dev_us - rtt_dev_baseline_us) / 64;
+  }
+};
+
+}  // namespace snap_arduino
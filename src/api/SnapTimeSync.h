@@ -1,14 +1,19 @@
 #pragma once
 #include "AudioTools.h"
 #include "SnapLogger.h"
+#include "SnapSnapshot.h"
 #include "SnapTime.h"
+#include <math.h>
 
 namespace snap_arduino {
 
 /**
  * @brief Abstract (Common) Time Synchronization Logic which consists of the
  * startup synchronization and the local to server clock synchronization which
- * adjusts the sampling rate.
+ * adjusts the sampling rate. The server times are recorded and evaluated by
+ * the task which processes the time messages: the resulting factor is
+ * published as snapshot to the audio output, which might run in a different
+ * task, so the recorded time points are never accessed by the output.
  * @author Phil Schatzmann
  * @version 0.1
  * @date 2023-10-28
@@ -21,25 +26,93 @@ public:
     setProcessingLag(processingLag);
   }
 
-  /// Starts the processing
-  void begin(int rate) {
+  /// Starts the processing: called by the audio output. The update count is
+  /// restarted with the next server time.
+  virtual void begin(int rate) {
+    restart_request.store(restart_request.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+    last_sync_count = 0;
+  }
+
+  /// Records the server time in microseconds which was valid at the
+  /// indicated local monotonic time (SnapTime::localMicros()), e.g. the
+  /// receive time of the time message
+  void updateServerTime(int64_t serverUs, int64_t localUs) {
+    uint32_t request = restart_request.load(std::memory_order_relaxed);
+    if (request != restart_done) {
+      restart_done = request;
+      update_count = 0;
+    }
+    addTimePoint(serverUs, toTimebase(localUs));
+    update_count++;
+    // the factor is only evaluated when the output is asking for it
+    if (update_count > 2 && update_count % interval == 0) {
+      factor = calculateFactor();
+    }
+    publish();
+  }
+
+  /// Records the actual server time in microseconds
+  void updateServerTime(int64_t serverUs) {
+    updateServerTime(serverUs, SnapTime::localMicros());
+  }
+
+  /// Removes the recorded server times (e.g. when the server clock changed)
+  virtual void resetTimePoints() {
     update_count = 0;
+    publish();
+  }
+
+  /// Records the actual playback delay of each audio chunk in microseconds
+  virtual void updateActualDelay(int64_t delayUs) {}
+
+  /// Defines the local time source (e.g. the SnapOutputClock) which is
+  /// compared with the server time: by default we use the CPU clock
+  void setTimebase(SnapTimebase &timebase) { p_timebase = &timebase; }
+
+  /// Provides the drift estimate of the server clock relative to the local
+  /// timebase in ppm (e.g. to persist it)
+  virtual float driftPPM() { return drift_ppm; }
+
+  /// Defines the drift estimate (e.g. restored after a reboot) which is used
+  /// until it can be measured
+  virtual void setDriftPPM(float ppm) {
+    drift_ppm = ppm;
+    factor = driftFactor();
+    publish();
   }
 
-  /// Records the actual server time in millisecondes
-  virtual void updateServerTime(uint32_t serverMillis) = 0;
+  /// Returns true if the drift has been measured
+  bool isDriftMeasured() { return is_drift_measured; }
 
-  /// Records the actual playback delay (currently not used)
-  virtual void updateActualDelay(int delay) {}
+  /// Provides the local time in us from the timebase
+  int64_t localMicros() {
+    return p_timebase == nullptr ? SnapTime::localMicros()
+                                 : p_timebase->localMicros();
+  }
+
+  /// Converts a local monotonic time to the time of the timebase
+  int64_t toTimebase(int64_t localUs) {
+    if (p_timebase == nullptr) return localUs;
+    return p_timebase->localMicros() - (SnapTime::localMicros() - localUs);
+  }
+
+  /// Provides the resampling factor for the output: with a positive delay we
+  /// play too fast and need to slow down
+  virtual float getFactor() { return clockFactor(); }
 
-  /// Calculate the resampling factor: with a positive delay we play too fast
-  /// and need to slow down
-  virtual float getFactor() = 0;
+  /// Provides the last published factor which compensates the clock drift
+  float clockFactor() { return published.get().factor; }
 
-  /// Returns true if a synchronization (update of the sampling rate) is needed.
+  /// Returns true if a synchronization (update of the sampling rate) is
+  /// needed: called by the audio output.
   bool isSync() {
-    bool result = active && update_count > 2 && update_count % interval == 0;
-    active = false;
+    SyncState state = published.get();
+    if (state.restart != restart_request.load(std::memory_order_relaxed))
+      return false;
+    bool result = state.update_count != last_sync_count &&
+                  state.update_count > 2 && state.update_count % interval == 0;
+    last_sync_count = state.update_count;
     return result;
   }
 
@@ -69,11 +142,50 @@ public:
   }
 
 protected:
+  /// State which is published to the audio output
+  struct SyncState {
+    float factor = 1.0f;
+    uint32_t update_count = 0;
+    uint32_t restart = 0;
+  };
   const char *TAG = "SnapTimeSync";
-  // resampling speed
-  uint64_t update_count = 0;
+  SnapTimebase *p_timebase = nullptr;
+  float drift_ppm = 0.0f;
+  bool is_drift_measured = false;
+
+  /// Records a server time and the corresponding time of the timebase
+  virtual void addTimePoint(int64_t serverUs, int64_t localUs) = 0;
+
+  /// Calculates the factor from the recorded time points
+  virtual float calculateFactor() = 0;
+
+  /// makes the actual factor and update count available to the output
+  void publish() {
+    SyncState state;
+    state.factor = factor;
+    state.update_count = update_count;
+    state.restart = restart_done;
+    published.set(state);
+  }
+
+  /// factor for the actual drift estimate
+  float driftFactor() { return 1.0f + drift_ppm / 1000000.0f; }
+
+  /// records the measured factor as drift
+  float setMeasuredFactor(float factor) {
+    drift_ppm = (factor - 1.0f) * 1000000.0f;
+    is_drift_measured = true;
+    return factor;
+  }
+  // resampling speed: updated by the task which records the server times
+  uint32_t update_count = 0;
+  uint32_t restart_done = 0;
+  float factor = 1.0f;
   int interval = 10;
-  bool active = false;
+  SnapSnapshot<SyncState> published;
+  // used by the audio output
+  std::atomic<uint32_t> restart_request{0};
+  uint32_t last_sync_count = 0;
   // start delay
   int processing_lag = 0;
   uint16_t message_buffer_delay_ms = 0;
@@ -94,32 +206,36 @@ public:
                       int interval = 10)
       : SnapTimeSync(processingLag, interval) {}
 
-  void updateServerTime(uint32_t serverMillis) override {
-    update_count++;
-    active = true;
-    SnapTimePoints tp{serverMillis};
+  void resetTimePoints() override {
+    time_points.clear();
+    SnapTimeSync::resetTimePoints();
+  }
+
+protected:
+  Vector<SnapTimePoints> time_points;
+
+  void addTimePoint(int64_t serverUs, int64_t localUs) override {
+    SnapTimePoints tp{serverUs, localUs};
     if (time_points.size()>=interval){
       time_points.pop_front();
     }
     time_points.push_back(tp);
   }
 
-  float getFactor() {
+  float calculateFactor() override {
     int last_idx = time_points.size()-1;
-    if (last_idx <=1) return 1.0;
-    float timespan_local_ms = time_points[last_idx].local_ms - time_points[0].local_ms;
-    float timespan_server_ms = time_points[last_idx].server_ms - time_points[0].server_ms;
-    if (timespan_local_ms == 0.0 || timespan_server_ms == 0.0) {
+    if (last_idx <=1) return driftFactor();
+    double timespan_local_us = time_points[last_idx].local_us - time_points[0].local_us;
+    double timespan_server_us = time_points[last_idx].server_us - time_points[0].server_us;
+    if (timespan_local_us == 0.0 || timespan_server_us == 0.0) {
       ESP_LOGE(TAG, "Could not determine clock differences");
-      return 1.0;
+      return driftFactor();
     }
     // if server time span is smaller then local, local runs faster and needs to be slowed down
-    float result_factor = timespan_server_ms / timespan_local_ms;    
+    float result_factor = timespan_server_us / timespan_local_us;    
     ESP_LOGI(TAG, "=> adjusting playback speed by factor: %f", result_factor);
-    return result_factor;
+    return setMeasuredFactor(result_factor);
   }
-protected:
-  Vector<SnapTimePoints> time_points;
 };
 
 /**
@@ -136,32 +252,259 @@ public:
                       int interval = 10)
       : SnapTimeSync(processingLag, interval) {}
 
-  void updateServerTime(uint32_t serverMillis) override {
+protected:
+  SnapTimePoints start_time;
+  SnapTimePoints current_time;
+
+  void addTimePoint(int64_t serverUs, int64_t localUs) override {
     if (update_count == 0){
-      start_time = SnapTimePoints(serverMillis);
+      start_time = SnapTimePoints(serverUs, localUs);
     }
-    current_time = SnapTimePoints(serverMillis);
-    update_count++;
-    active = true;
+    current_time = SnapTimePoints(serverUs, localUs);
   }
 
-  float getFactor() {
-    float timespan_local_ms = current_time.local_ms - start_time.local_ms;
-    float timespan_server_ms = current_time.server_ms - start_time.server_ms;
-    if (timespan_local_ms == 0.0 || timespan_server_ms == 0.0) {
+  float calculateFactor() override {
+    double timespan_local_us = current_time.local_us - start_time.local_us;
+    double timespan_server_us = current_time.server_us - start_time.server_us;
+    if (timespan_local_us == 0.0 || timespan_server_us == 0.0) {
       ESP_LOGE(TAG, "Could not determine clock differences");
-      return 1.0;
+      return driftFactor();
     }
     // if server time span is smaller then local, local runs faster and needs to be slowed down
-    float result_factor = timespan_server_ms / timespan_local_ms;    
+    float result_factor = timespan_server_us / timespan_local_us;    
     ESP_LOGI(TAG, "=> adjusting playback speed by factor: %f", result_factor);
-    return result_factor;
+    return setMeasuredFactor(result_factor);
   }
+};
+
+
+/**
+ * @brief Estimates the clock drift with a least squares fit of the server
+ * time against the local time over a sliding window. Points which deviate
+ * too much from the line (e.g. delayed time messages) are rejected and the
+ * line is fitted again, so that the factor is much more stable than the
+ * two point estimate of SnapTimeSyncDynamic.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ **/
+class SnapTimeSyncRegression : public SnapTimeSync {
+public:
+  SnapTimeSyncRegression(int processingLag = CONFIG_PROCESSING_TIME_MS,
+                         int interval = 10, int window = 60)
+      : SnapTimeSync(processingLag, interval) {
+    setWindow(window);
+  }
+
+  void resetTimePoints() override {
+    time_points.clear();
+    SnapTimeSync::resetTimePoints();
+  }
+
+  /// Defines the number of time points that are used for the fit
+  void setWindow(int points) { window = std::max(3, points); }
+
+  /// Points with a bigger deviation from the line than this value are
+  /// always accepted (default 2 ms)
+  void setMinOutlierLimit(float ms) { min_outlier_limit_ms = ms; }
+
 protected:
-  SnapTimePoints start_time;
-  SnapTimePoints current_time;
+  Vector<SnapTimePoints> time_points;
+  int window = 60;
+  float min_outlier_limit_ms = 2.0f;
+  int inlier_count = 0;
+
+  void addTimePoint(int64_t serverUs, int64_t localUs) override {
+    SnapTimePoints tp{serverUs, localUs};
+    while (time_points.size() >= window) {
+      time_points.pop_front();
+    }
+    time_points.push_back(tp);
+  }
+
+  float calculateFactor() override {
+    if (fit()) {
+      ESP_LOGI(TAG, "=> drift: %f ppm (%d of %d points)", drift_ppm,
+               inlier_count, (int)time_points.size());
+    }
+    // if server time runs slower then local, local needs to be slowed down
+    return driftFactor();
+  }
+
+  /// Least squares fit of server time = offset + slope * local time: returns
+  /// false if there are not enough points
+  bool fit() {
+    int count = time_points.size();
+    if (count < 3) return false;
+    double slope, offset;
+    if (!fitLine(-1.0, slope, offset)) return false;
+
+    // reject the points with a residual > 3 standard deviations
+    double sum_sq = 0;
+    for (int j = 0; j < count; j++) {
+      double r = residual(j, slope, offset);
+      sum_sq += r * r;
+    }
+    double limit = std::max(3.0 * sqrt(sum_sq / count),
+                            min_outlier_limit_ms * 1000.0);
+    if (!fitLine(limit, slope, offset)) return false;
+
+    drift_ppm = (slope - 1.0) * 1000000.0;
+    is_drift_measured = true;
+    return true;
+  }
+
+  /// fits the line over all points with a residual below the limit (with
+  /// the previous slope and offset): a negative limit uses all points
+  bool fitLine(double limit, double &slope, double &offset) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int n = 0;
+    for (int j = 0; j < (int)time_points.size(); j++) {
+      if (limit >= 0 && fabs(residual(j, slope, offset)) > limit) continue;
+      double x = localUs(j), y = serverUs(j);
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+      n++;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (n < 3 || denominator == 0.0) {
+      ESP_LOGE(TAG, "Could not determine clock differences");
+      return false;
+    }
+    inlier_count = n;
+    slope = (n * sxy - sx * sy) / denominator;
+    offset = (sy - slope * sx) / n;
+    return true;
+  }
+
+  /// times relative to the first point to keep the precision of the sums
+  double localUs(int j) {
+    return time_points[j].local_us - time_points[0].local_us;
+  }
+
+  double serverUs(int j) {
+    return time_points[j].server_us - time_points[0].server_us;
+  }
+
+  double residual(int j, double slope, double offset) {
+    return serverUs(j) - (offset + slope * localUs(j));
+  }
 };
 
+/**
+ * @brief Closed loop controller: the clock drift from the regression is used
+ * as feed forward and the measured playback delay is driven to the target
+ * with a PI law. So we also correct the offset which has accumulated since
+ * the start and not only the rate. The correction is clamped and within the
+ * deadband (with hysteresis) the factor is not changed.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ **/
+class SnapTimeSyncPI : public SnapTimeSyncRegression {
+public:
+  SnapTimeSyncPI(int processingLag = CONFIG_PROCESSING_TIME_MS,
+                 int interval = 1, int window = 60)
+      : SnapTimeSyncRegression(processingLag, interval, window) {}
+
+  void begin(int rate) override {
+    SnapTimeSyncRegression::begin(rate);
+    has_target = is_fixed_target;
+    integral = 0.0f;
+    correction_ppm = 0.0f;
+    delay_sum_us = 0;
+    delay_count = 0;
+    is_locked = false;
+    last_update_us = SnapTime::localMicros();
+  }
+
+  void updateActualDelay(int64_t delayUs) override {
+    delay_sum_us += delayUs;
+    delay_count++;
+  }
+
+  /// Called by the audio output: the drift is compensated with the
+  /// published factor of the regression
+  float getFactor() override {
+    float base = clockFactor();
+    int64_t time_us = SnapTime::localMicros();
+    float dt_sec = (time_us - last_update_us) / 1000000.0f;
+    last_update_us = time_us;
+    if (delay_count == 0) return base - correction_ppm / 1000000.0f;
+
+    float delay = delay_sum_us / 1000.0f / delay_count;
+    delay_sum_us = 0;
+    delay_count = 0;
+    if (!has_target) {
+      // the first average after the start defines the target
+      target_delay_ms = delay;
+      has_target = true;
+      return base;
+    }
+
+    // with a positive error we play too fast and need to slow down
+    error_ms = delay - target_delay_ms;
+    float abs_error = fabs(error_ms);
+    if (is_locked && abs_error > 2.0f * deadband_ms) is_locked = false;
+    if (!is_locked && abs_error < deadband_ms) is_locked = true;
+
+    if (!is_locked) {
+      integral += error_ms * dt_sec;
+      // anti windup: the integral part alone must stay within the limit
+      float max_integral = ki > 0.0f ? max_correction_ppm / ki : 0.0f;
+      integral = std::max(-max_integral, std::min(max_integral, integral));
+      correction_ppm = kp * error_ms + ki * integral;
+      correction_ppm = std::max(-max_correction_ppm,
+                                std::min(max_correction_ppm, correction_ppm));
+    }
+    ESP_LOGI(TAG, "=> delay error: %f ms, correction: %f ppm", error_ms,
+             correction_ppm);
+    return base - correction_ppm / 1000000.0f;
+  }
+
+  /// Defines the gains: kp in ppm per ms error, ki in ppm per ms*sec
+  void setGains(float kp, float ki) {
+    this->kp = kp;
+    this->ki = ki;
+  }
+
+  /// Defines the max correction in ppm (default 500)
+  void setMaxCorrection(float ppm) { max_correction_ppm = ppm; }
+
+  /// Errors within the deadband do not change the correction (default 1 ms)
+  void setDeadband(float ms) { deadband_ms = ms; }
+
+  /// Defines the target delay: by default we use the average delay measured
+  /// after the start
+  void setTargetDelay(float ms) {
+    target_delay_ms = ms;
+    is_fixed_target = true;
+    has_target = true;
+  }
+
+  /// Provides the last delay error in ms
+  float delayError() { return error_ms; }
+
+protected:
+  float kp = 50.0f;
+  float ki = 0.5f;
+  float max_correction_ppm = 500.0f;
+  float deadband_ms = 1.0f;
+  float target_delay_ms = 0.0f;
+  float error_ms = 0.0f;
+  float integral = 0.0f;
+  float correction_ppm = 0.0f;
+  bool has_target = false;
+  bool is_fixed_target = false;
+  bool is_locked = false;
+  int64_t delay_sum_us = 0;
+  int delay_count = 0;
+  int64_t last_update_us = 0;
+};
 
 /**
  * @brief Uses predefined fixed factor
@@ -178,12 +521,14 @@ public:
     resample_factor = factor;
   }
 
-  void updateServerTime(uint32_t serverMillis) override {}
-
-  float getFactor() { return resample_factor; }
+  float getFactor() override { return resample_factor; }
 
 protected:
   float resample_factor;
+
+  void addTimePoint(int64_t serverUs, int64_t localUs) override {}
+
+  float calculateFactor() override { return resample_factor; }
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "AudioTools.h"
+#include "SnapLogger.h"
+
+namespace snap_arduino {
+
+/**
+ * @brief Fused output stage for interleaved 16 bit audio which applies the
+ * volume and the (linear interpolating) resampling in one pass over the
+ * frames: this replaces the VolumeStream and the ResampleStream of the output
+ * chain. For the small step sizes which are used to correct the clock drift
+ * the fractional position changes linearly within a run of frames, so the
+ * inner loops only work on contiguous arrays and can be vectorized by the
+ * compiler.
+ * @author Phil Schatzmann
+ * @version 0.1
+ * @date 2026-10-17
+ * @copyright Copyright (c) 2026
+ */
+class SnapVolumeResampleStream : public AudioStream {
+ public:
+  /// Defines the next stage of the output chain
+  void setOutput(Print &out) { p_out = &out; }
+
+  bool begin() override {
+    has_last_frame = false;
+    partial_len = 0;
+    pos = 1.0;
+    return info.bits_per_sample == 16 && info.channels > 0 &&
+           info.channels <= max_channels;
+  }
+
+  /// Defines the (linear) volume factor
+  void setVolume(float volume) { gain = volume; }
+
+  /// Provides the volume factor
+  float volume() { return gain; }
+
+  /// Defines the step size: > 1 to play faster, < 1 to play slower
+  void setStepSize(float step) {
+    step_size = std::min(1.5f, std::max(0.5f, step));
+  }
+
+  /// Provides the actual step size
+  float getStepSize() { return step_size; }
+
+  size_t write(const uint8_t *data, size_t len) override {
+    if (p_out == nullptr) return 0;
+    int channels = info.channels;
+    if (info.bits_per_sample != 16 || channels <= 0 || channels > max_channels)
+      return p_out->write(data, len);
+
+    // keep incomplete frames for the next write
+    size_t frame_size = channels * sizeof(int16_t);
+    size_t result = len;
+    if (partial_len > 0) {
+      size_t n = std::min(frame_size - partial_len, len);
+      memcpy(partial + partial_len, data, n);
+      partial_len += n;
+      data += n;
+      len -= n;
+      if (partial_len < frame_size) return result;
+      processFrames((const int16_t *)partial, 1);
+      partial_len = 0;
+    }
+    size_t frames = len / frame_size;
+    // the data might not be aligned for int16_t access
+    if (frames > 0) {
+      if (((uintptr_t)data % alignof(int16_t)) == 0) {
+        processFrames((const int16_t *)data, frames);
+      } else {
+        for (size_t j = 0; j < frames; j++) {
+          int16_t frame[max_channels];
+          memcpy(frame, data + j * frame_size, frame_size);
+          processFrames(frame, 1);
+        }
+      }
+    }
+    partial_len = len - frames * frame_size;
+    memcpy(partial, data + frames * frame_size, partial_len);
+    return result;
+  }
+
+  int availableForWrite() override {
+    return p_out == nullptr ? 0 : p_out->availableForWrite();
+  }
+
+ protected:
+  static const int max_channels = 8;
+  static const int out_frames = 128;
+  const char *TAG = "SnapVolumeResampleStream";
+  Print *p_out = nullptr;
+  float gain = 1.0f;
+  float step_size = 1.0f;
+  // position of the next output frame: 0 is the last frame of the previous
+  // write and 1 the first frame of the actual data
+  double pos = 1.0;
+  int16_t last_frame[max_channels] = {0};
+  bool has_last_frame = false;
+  alignas(int16_t) uint8_t partial[max_channels * sizeof(int16_t)];
+  size_t partial_len = 0;
+  int16_t out[out_frames * max_channels];
+
+  void processFrames(const int16_t *in, size_t frames) {
+    if (step_size == 1.0f && pos == 1.0) {
+      processGain(in, frames);
+    } else {
+      processResample(in, frames);
+    }
+    memcpy(last_frame, in + (frames - 1) * info.channels,
+           info.channels * sizeof(int16_t));
+    has_last_frame = true;
+  }
+
+  /// volume only: w/o resampling we can just scale the samples
+  void processGain(const int16_t *in, size_t frames) {
+    int channels = info.channels;
+    size_t samples = frames * channels;
+    const size_t max_samples = out_frames * channels;
+    for (size_t start = 0; start < samples; start += max_samples) {
+      size_t n = std::min(max_samples, samples - start);
+      scale(in + start, out, n, gain);
+      writeOut(out, n);
+    }
+  }
+
+  /// resampling and volume: the output frames are determined in runs in
+  /// which the integer part of the position advances with the frame index
+  void processResample(const int16_t *in, size_t frames) {
+    int channels = info.channels;
+    if (!has_last_frame) {
+      memcpy(last_frame, in, channels * sizeof(int16_t));
+    }
+    double step = step_size;
+    double delta = step - 1.0;
+    size_t out_count = 0;
+    // positions are relative to the last frame of the previous write
+    while (pos < (double)frames) {
+      int64_t idx = (int64_t)pos;
+      float frac = pos - idx;
+      // number of output frames for which idx - j stays the same
+      size_t run = frames - idx;
+      if (delta > 0.0) {
+        run = std::min(run, (size_t)((1.0 - frac) / delta) + 1);
+      } else if (delta < 0.0) {
+        run = std::min(run, (size_t)(frac / -delta) + 1);
+      }
+      run = std::min(run, (size_t)(out_frames - out_count));
+      const int16_t *a;
+      const int16_t *b;
+      if (idx == 0) {
+        // interpolation with the last frame of the previous write
+        a = last_frame;
+        b = in;
+        run = 1;
+      } else {
+        a = in + (idx - 1) * channels;
+        b = a + channels;
+      }
+      interpolate(a, b, out + out_count * channels, run, channels, frac,
+                  (float)delta);
+      out_count += run;
+      pos += step * run;
+      if (out_count == out_frames) {
+        writeOut(out, out_count * channels);
+        out_count = 0;
+      }
+    }
+    writeOut(out, out_count * channels);
+    pos -= frames;
+  }
+
+  /// out[j] = (a[j] + frac_j * (b[j] - a[j])) * gain with frac_j = frac +
+  /// j * delta: plain loops over contiguous arrays
+  void interpolate(const int16_t *__restrict a, const int16_t *__restrict b,
+                   int16_t *__restrict result, size_t frames, int channels,
+                   float frac, float delta) {
+    const float g = gain;
+    if (channels == 2) {
+      // one flat loop over the interleaved samples
+      int n = frames * 2;
+      for (int i = 0; i < n; i++) {
+        float f = frac + (i >> 1) * delta;
+        result[i] = clip((a[i] + f * (b[i] - a[i])) * g);
+      }
+      return;
+    }
+    for (size_t j = 0; j < frames; j++) {
+      float f = frac + j * delta;
+      for (int ch = 0; ch < channels; ch++) {
+        size_t i = j * channels + ch;
+        result[i] = clip((a[i] + f * (b[i] - a[i])) * g);
+      }
+    }
+  }
+
+  /// scales the samples by the gain
+  static void scale(const int16_t *__restrict in, int16_t *__restrict result,
+                    size_t samples, float g) {
+    for (size_t j = 0; j < samples; j++) {
+      result[j] = clip(in[j] * g);
+    }
+  }
+
+  static inline int16_t clip(float value) {
+    value = std::min(32767.0f, std::max(-32768.0f, value));
+    return (int16_t)value;
+  }
+
+  /// writes all samples to the next stage
+  void writeOut(const int16_t *samples, size_t count) {
+    const uint8_t *data = (const uint8_t *)samples;
+    size_t len = count * sizeof(int16_t);
+    size_t written = 0;
+    int retry = 0;
+    while (written < len) {
+      size_t result = p_out->write(data + written, len - written);
+      written += result;
+      if (result == 0 && ++retry > 10) {
+        ESP_LOGW(TAG, "Could not write all data %zu -> %zu", len, written);
+        break;
+      }
+    }
+  }
+};
+
+}  // namespace snap_arduino